@@ -16,6 +16,11 @@
 #include <linux/slab.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/sched/rt.h>
+#include <linux/debugfs.h>
+#include <linux/utsname.h>
+#include <linux/nodemask.h>
 
 /* kthread sample */
 #include <linux/kthread.h>
@@ -29,12 +34,50 @@ static long locktest_counter2;
 
 static DEFINE_SPINLOCK(locktest_spinlock);
 static DEFINE_SEMAPHORE(locktest_semaphore);
+static DEFINE_MUTEX(locktest_mutex);
 static int locktest_thread_done[NUM_THREADS];
 
 static int threads = -1;
 static int iters = NUM_ITERATIONS;
+/* kthreads per cpu, above 1 the cpus are oversubscribed */
+static int oversubscribe = 1;
+/* how many of the kthreads run SCHED_FIFO, the others stay SCHED_NORMAL */
+static int fifo_threads;
+/* every preempt_every iterations the lock holder is off cpu for preempt_us */
+static int preempt_every;
+static int preempt_us = 50;
 
 #define KTHREAD_NAME_MAX 32
+#define RESULT_MAX 512
+/* Power of two wait buckets, bucket i counts waits < 2^i ns */
+#define WAIT_BUCKETS 40
+#define RECORD_MAX 1024
+#define RECORDS_SIZE (64 * 1024)
+
+/*
+ * Per kthread state of start_test(). Wait is the time from asking for the
+ * lock to getting it.
+ */
+struct locktest_thread {
+    int done;
+    u64 start_ns;
+    u64 end_ns;
+    u64 wait_total_ns;
+    u64 wait_max_ns;
+    u64 wait_hist[WAIT_BUCKETS];
+};
+
+static char locktest_result[RESULT_MAX];
+
+/*
+ * Result records of the runs since load or the last clear, one JSON
+ * object per line, read through debugfs locktest/results. Same fields
+ * as memtest and l2_packet_sender, see results/compare_results.py.
+ */
+static DEFINE_MUTEX(locktest_records_lock);
+static char locktest_records[RECORDS_SIZE];
+static size_t locktest_records_len;
+static struct dentry *locktest_debugfs;
 
 static int locktest_thread_spinlock(void *data)
 {
@@ -108,77 +151,279 @@ static int locktest_perform_test(char *buf, size_t size, int (*threadfn)(void *d
     return total;
 }
 
+/* Called after the unlock, only the acquire time is taken under the lock */
+static inline void locktest_account_wait(struct locktest_thread *t, u64 wait)
+{
+    t->wait_total_ns += wait;
+    if (wait > t->wait_max_ns)
+        t->wait_max_ns = wait;
+    t->wait_hist[min_t(int, fls64(wait), WAIT_BUCKETS - 1)]++;
+}
+
+/*
+ * Lock holder preemption. A sleeping lock holder really leaves the cpu, a
+ * spinlock holder cannot, so it burns the time instead like a vcpu that is
+ * descheduled by the hypervisor while holding the lock.
+ */
+static inline void locktest_preempt(int i, int preempt_every_local, bool can_sleep)
+{
+    if (!preempt_every_local || i % preempt_every_local)
+        return;
+
+    if (can_sleep)
+        usleep_range(preempt_us, preempt_us + 1);
+    else
+        udelay(preempt_us);
+}
+
 static int locktest_thread_spinlock2(void *data)
 {
-    int i, iters_local = iters;
+    struct locktest_thread *t = data;
+    int i, iters_local = iters, preempt_every_local = preempt_every;
 
+    t->start_ns = ktime_get_ns();
     for (i = 0; i < iters_local; i++) {
+        u64 asked = ktime_get_ns(), acquired;
+
         spin_lock(&locktest_spinlock);
+        acquired = ktime_get_ns();
         locktest_counter2++;
+        locktest_preempt(i, preempt_every_local, false);
         spin_unlock(&locktest_spinlock);
+        locktest_account_wait(t, acquired - asked);
     }
+    t->end_ns = ktime_get_ns();
 
-    *(int *) data = true;
+    smp_store_release(&t->done, true);
 
     do_exit(0);
 }
 
 static int locktest_thread_semaphore2(void *data)
 {
-    int i, iters_local = iters;
+    struct locktest_thread *t = data;
+    int i, iters_local = iters, preempt_every_local = preempt_every;
 
+    t->start_ns = ktime_get_ns();
     for (i = 0; i < iters_local; i++) {
+        u64 asked = ktime_get_ns(), acquired;
         int ret = down_interruptible(&locktest_semaphore);
         if (ret)
-            return 0;
+            break;
+        acquired = ktime_get_ns();
         locktest_counter2++;
+        locktest_preempt(i, preempt_every_local, true);
         up(&locktest_semaphore);
+        locktest_account_wait(t, acquired - asked);
     }
+    t->end_ns = ktime_get_ns();
 
-    *(int *) data = true;
+    smp_store_release(&t->done, true);
 
     do_exit(0);
 }
 
+/* mutex spins optimistically while the owner runs, the semaphore never does */
+static int locktest_thread_mutex2(void *data)
+{
+    struct locktest_thread *t = data;
+    int i, iters_local = iters, preempt_every_local = preempt_every;
+
+    t->start_ns = ktime_get_ns();
+    for (i = 0; i < iters_local; i++) {
+        u64 asked = ktime_get_ns(), acquired;
+
+        mutex_lock(&locktest_mutex);
+        acquired = ktime_get_ns();
+        locktest_counter2++;
+        locktest_preempt(i, preempt_every_local, true);
+        mutex_unlock(&locktest_mutex);
+        locktest_account_wait(t, acquired - asked);
+    }
+    t->end_ns = ktime_get_ns();
+
+    smp_store_release(&t->done, true);
+
+    do_exit(0);
+}
+
+/* Upper bound of the bucket holding the @pct percentile, at most @max */
+static u64 locktest_percentile(const u64 *hist, u64 count, int pct, u64 max)
+{
+    u64 seen = 0, rank = div64_u64(count * pct + 99, 100);
+    int i;
+
+    for (i = 0; i < WAIT_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen && seen >= rank)
+            return min_t(u64, 1ULL << i, max);
+    }
+
+    return max;
+}
+
+/* @str as the inside of a JSON string, into @buf of @size bytes */
+static const char *locktest_json_escape(char *buf, size_t size, const char *str)
+{
+    size_t len = 0;
+
+    for (; *str && len + 7 <= size; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            len += snprintf(buf + len, size - len, "\\%c", c);
+        else if (c < 0x20)
+            len += snprintf(buf + len, size - len, "\\u%04x", c);
+        else
+            buf[len++] = c;
+    }
+    buf[len] = '\0';
+
+    return buf;
+}
+
+/*
+ * Appends the record of a start_test() run, oldest records make room. A
+ * record that does not fit RECORD_MAX is dropped rather than cut short.
+ */
+static void locktest_add_record(const char *testname, int threads_local, int iters_local,
+                                long ops, long expected, u64 elapsed, u64 wait_total,
+                                u64 wait_max, const u64 *wait_hist)
+{
+    /* Escaped worst case, static as they are only used under the lock */
+    static char nodename[__NEW_UTS_LEN * 6 + 1], release[__NEW_UTS_LEN * 6 + 1];
+    char *end;
+    int len;
+
+    mutex_lock(&locktest_records_lock);
+    while (RECORDS_SIZE - locktest_records_len < RECORD_MAX) {
+        end = strnchr(locktest_records, locktest_records_len, '\n');
+        len = end ? end - locktest_records + 1 : locktest_records_len;
+        memmove(locktest_records, locktest_records + len, locktest_records_len - len);
+        locktest_records_len -= len;
+    }
+
+    len = snprintf(locktest_records + locktest_records_len, RECORD_MAX,
+                   "{\"tool\": \"locktest\", \"mode\": \"%s\", "
+                   "\"params\": {\"threads\": %d, \"per_cpu\": %d, \"fifo\": %d, "
+                   "\"preempt_every\": %d, \"preempt_us\": %d, \"iters\": %d}, "
+                   "\"host\": {\"hostname\": \"%s\", \"kernel\": \"%s\", \"cpus\": %u, \"nodes\": %u}, "
+                   "\"time\": %lld, \"duration_ns\": %llu, "
+                   "\"throughput\": %llu, \"throughput_unit\": \"ops/s\", "
+                   "\"latency_ns\": {\"avg\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}, "
+                   "\"errors\": %ld}\n",
+                   testname, threads_local, oversubscribe, fifo_threads, preempt_every, preempt_us,
+                   iters_local,
+                   locktest_json_escape(nodename, sizeof(nodename), utsname()->nodename),
+                   locktest_json_escape(release, sizeof(release), utsname()->release),
+                   num_online_cpus(),
+                   num_online_nodes(), (long long)ktime_get_real_seconds(), elapsed,
+                   div64_u64((u64)ops * NSEC_PER_SEC, elapsed),
+                   ops ? div64_u64(wait_total, ops) : 0,
+                   locktest_percentile(wait_hist, ops, 50, wait_max),
+                   locktest_percentile(wait_hist, ops, 90, wait_max),
+                   locktest_percentile(wait_hist, ops, 99, wait_max),
+                   wait_max, abs(expected - ops));
+    if (len < RECORD_MAX)
+        locktest_records_len += len;
+    else
+        pr_warn("%s: %s record too long, dropped\n", __func__, testname);
+    mutex_unlock(&locktest_records_lock);
+}
+
+static ssize_t locktest_records_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    ssize_t ret;
+
+    mutex_lock(&locktest_records_lock);
+    ret = simple_read_from_buffer(buf, count, ppos, locktest_records, locktest_records_len);
+    mutex_unlock(&locktest_records_lock);
+
+    return ret;
+}
+
+/* Any write clears the records */
+static ssize_t locktest_records_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    mutex_lock(&locktest_records_lock);
+    locktest_records_len = 0;
+    mutex_unlock(&locktest_records_lock);
+
+    return count;
+}
+
+static const struct file_operations locktest_records_fops = {
+    .owner = THIS_MODULE,
+    .read = locktest_records_read,
+    .write = locktest_records_write,
+    .llseek = default_llseek,
+};
+
+/*
+ * Cpu of the @i-th kthread, round-robin over as many online cpus as there
+ * are threads, so every cpu used gets the same share of the kthreads
+ */
+static int locktest_cpu(int i, int threads_local)
+{
+    int n = i % min_t(int, threads_local, num_online_cpus()), cpu;
+
+    for_each_online_cpu(cpu)
+        if (n-- == 0)
+            return cpu;
+
+    return cpumask_first(cpu_online_mask);
+}
+
 /*
  * Main test-executing function
  *
- * Function will start @threads number of kthreads, binded
- * to cpus where threads will be round robined to available
- * cpus. test_function will be given as entry point to these
- * kthreads.
+ * Function will start @threads * @oversubscribe number of kthreads,
+ * binded to cpus where threads will be round robined to the first
+ * min(@threads, online cpus) cpus, see locktest_cpu(). The first
+ * @fifo_threads kthreads (at most one per cpu while fifo_threads <=
+ * threads) run SCHED_FIFO. test_function will be given as entry point to
+ * these kthreads.
  *
- * It is task of test_function to implement int flag being set
- * to true when function is done.
+ * It is task of test_function to fill its struct locktest_thread and to
+ * set done to true when function is done. Throughput and lock wait of the
+ * run are left in locktest_result.
  *
  * */
-static int start_test(int (*test_function)(void *))
+static int start_test(int (*test_function)(void *), const char *testname)
 {
     char kthread_name[KTHREAD_NAME_MAX];
-    int cpu = -1, err = 0, threads_local, i;
-    int *kthread_done;
+    int cpu, err = 0, threads_local, iters_local, total, i, b;
+    struct locktest_thread *kthread_state;
     struct task_struct **kthreads;
+    u64 start = U64_MAX, end = 0, wait_total = 0, wait_max = 0, elapsed;
+    u64 wait_hist[WAIT_BUCKETS] = {};
 
     locktest_counter2 = 0;
     threads_local = threads;
+    iters_local = iters;
+    total = threads_local * oversubscribe;
+    if (total <= 0)
+        return -EINVAL;
 
-    kthreads = (struct task_struct **) kmalloc(threads_local * sizeof(struct task_struct*), GFP_KERNEL);
+    kthreads = (struct task_struct **) kmalloc(total * sizeof(struct task_struct*), GFP_KERNEL);
     if (kthreads == NULL) {
         pr_err("%s: Failed to allocate array of task pointers\n", __func__);
         return -ENOMEM;
     }
 
-    kthread_done = (int *) kzalloc(threads_local * sizeof(int), GFP_KERNEL);
-    if (kthread_done == NULL) {
-        pr_err("%s: Failed to allocate array of flags\n", __func__);
+    kthread_state = (struct locktest_thread *) kzalloc(total * sizeof(struct locktest_thread), GFP_KERNEL);
+    if (kthread_state == NULL) {
+        pr_err("%s: Failed to allocate array of thread states\n", __func__);
+        kfree(kthreads);
         return -ENOMEM;
     }
 
-    for(i = 0; i < threads_local; i++) {
-        cpu = cpumask_next(cpu, cpu_online_mask);
-        snprintf(kthread_name, KTHREAD_NAME_MAX, "test_kthread.%d", cpu);
+    for(i = 0; i < total; i++) {
+        cpu = locktest_cpu(i, threads_local);
+        snprintf(kthread_name, KTHREAD_NAME_MAX, "test_kthread.%d.%d", cpu,
+                 i / min_t(int, threads_local, num_online_cpus()));
         kthreads[i] = kthread_create_on_node(test_function,
-                                             &kthread_done[i],
+                                             &kthread_state[i],
                                              cpu_to_node(cpu),
                                              kthread_name);
         if (IS_ERR(kthreads[i])) {
@@ -187,15 +432,36 @@ static int start_test(int (*test_function)(void *))
             break;
         }
         kthread_bind(kthreads[i], cpu);
+        if (i < fifo_threads)
+            sched_set_fifo(kthreads[i]);
         wake_up_process(kthreads[i]);
     }
 
-    while (i--)
-        while (!kthread_done[i])
+    while (i--) {
+        while (!smp_load_acquire(&kthread_state[i].done))
             msleep(1);
+        start = min(start, kthread_state[i].start_ns);
+        end = max(end, kthread_state[i].end_ns);
+        wait_total += kthread_state[i].wait_total_ns;
+        wait_max = max(wait_max, kthread_state[i].wait_max_ns);
+        for (b = 0; b < WAIT_BUCKETS; b++)
+            wait_hist[b] += kthread_state[i].wait_hist[b];
+    }
+
+    elapsed = end > start ? end - start : 1;
+    snprintf(locktest_result, RESULT_MAX,
+             "%s threads %d per_cpu %d fifo %d preempt_every %d preempt_us %d "
+             "ops %ld time_ns %llu ops_per_sec %llu wait_avg_ns %llu wait_max_ns %llu\n",
+             testname, threads_local, oversubscribe, fifo_threads, preempt_every, preempt_us,
+             locktest_counter2, elapsed,
+             div64_u64((u64)locktest_counter2 * NSEC_PER_SEC, elapsed),
+             locktest_counter2 ? div64_u64(wait_total, locktest_counter2) : 0, wait_max);
+    pr_info("%s: %s", __func__, locktest_result);
+    locktest_add_record(testname, threads_local, iters_local, locktest_counter2,
+                        (long)total * iters_local, elapsed, wait_total, wait_max, wait_hist);
 
     kfree(kthreads);
-    kfree(kthread_done);
+    kfree(kthread_state);
 
     return err;
 }
@@ -214,7 +480,7 @@ static ssize_t run_spinlock_store(struct device *dev, struct device_attribute *a
 
     pr_info("%s: Starting spinlock test, threads %d, iterations %d\n", __func__, threads, iters);
 
-    err = start_test(locktest_thread_spinlock2);
+    err = start_test(locktest_thread_spinlock2, "spinlock");
     if (err) {
         pr_err("%s: Test returned error!\n", __func__);
         return err;
@@ -240,7 +506,7 @@ static ssize_t run_semaphore_store(struct device *dev, struct device_attribute *
 
     pr_info("%s: Starting semaphore test, threads %d, iterations %d\n", __func__, threads, iters);
 
-    err = start_test(locktest_thread_semaphore2);
+    err = start_test(locktest_thread_semaphore2, "semaphore");
     if (err) {
         pr_err("%s: Test returned error!\n", __func__);
         return err;
@@ -256,6 +522,32 @@ static ssize_t run_semaphore_show(struct device *dev, struct device_attribute *a
     return snprintf(buf, PAGE_SIZE, "echo anything to run\n");
 }
 
+/*
+ * Executes mutex test taking into account threads and iterations variable
+ * To execute, echo anything into it
+ */
+static ssize_t run_mutex_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int err;
+
+    pr_info("%s: Starting mutex test, threads %d, iterations %d\n", __func__, threads, iters);
+
+    err = start_test(locktest_thread_mutex2, "mutex");
+    if (err) {
+        pr_err("%s: Test returned error!\n", __func__);
+        return err;
+    }
+
+    pr_info("%s: done, locktest_counter = %ld", __func__, locktest_counter2);
+
+    return count;
+}
+
+static ssize_t run_mutex_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "echo anything to run\n");
+}
+
 /*
  * Number of iterations to run each thread. Taken into account on next run
  */
@@ -302,6 +594,108 @@ static ssize_t threads_show(struct device *dev, struct device_attribute *attr, c
     return snprintf(buf, PAGE_SIZE, "%d\n", threads);
 }
 
+/*
+ * Kthreads per cpu, the cpus are oversubscribed above 1. Taken into account on next run
+ * */
+static ssize_t oversubscribe_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int err;
+
+    err = sscanf(buf, "%d", &oversubscribe);
+    if (err != 1 || oversubscribe < 1) {
+        pr_err("%s: Failed to parse <%s> into positive integer\n", __func__, buf);
+        oversubscribe = 1;
+        return -EINVAL;
+    } else {
+        pr_info("%s: Kthreads per cpu set to %d\n", __func__, oversubscribe);
+    }
+
+    return count;
+}
+
+static ssize_t oversubscribe_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d\n", oversubscribe);
+}
+
+/*
+ * Number of kthreads running SCHED_FIFO, the rest contend at normal priority.
+ * Taken into account on next run
+ * */
+static ssize_t fifo_threads_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int err;
+
+    err = sscanf(buf, "%d", &fifo_threads);
+    if (err != 1) {
+        pr_err("%s: Failed to parse <%s> into integer\n", __func__, buf);
+        return -EINVAL;
+    } else {
+        pr_info("%s: Number of SCHED_FIFO threads set to %d\n", __func__, fifo_threads);
+    }
+
+    return count;
+}
+
+static ssize_t fifo_threads_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d\n", fifo_threads);
+}
+
+/*
+ * Lock holder preemption: every preempt_every iterations (0 is off) the holder
+ * is off cpu for preempt_us inside the critical section. Taken into account on next run
+ * */
+static ssize_t preempt_every_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int err;
+
+    err = sscanf(buf, "%d", &preempt_every);
+    if (err != 1 || preempt_every < 0) {
+        pr_err("%s: Failed to parse <%s> into integer\n", __func__, buf);
+        preempt_every = 0;
+        return -EINVAL;
+    } else {
+        pr_info("%s: Preemption every %d iterations\n", __func__, preempt_every);
+    }
+
+    return count;
+}
+
+static ssize_t preempt_every_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d\n", preempt_every);
+}
+
+static ssize_t preempt_us_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int err;
+
+    err = sscanf(buf, "%d", &preempt_us);
+    if (err != 1 || preempt_us < 0) {
+        pr_err("%s: Failed to parse <%s> into integer\n", __func__, buf);
+        preempt_us = 50;
+        return -EINVAL;
+    } else {
+        pr_info("%s: Preemption length set to %d us\n", __func__, preempt_us);
+    }
+
+    return count;
+}
+
+static ssize_t preempt_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d\n", preempt_us);
+}
+
+/*
+ * Throughput and lock wait of the last run_spinlock, run_semaphore or run_mutex
+ * */
+static ssize_t result_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%s", locktest_result);
+}
+
 static ssize_t run_basic_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
     size_t limit = PAGE_SIZE;
@@ -333,17 +727,29 @@ static struct device locktest_device;
 
 static DEVICE_ATTR(run_spinlock, S_IRUGO | S_IWUSR | S_IWGRP, run_spinlock_show, run_spinlock_store);
 static DEVICE_ATTR(run_semaphore, S_IRUGO | S_IWUSR | S_IWGRP, run_semaphore_show, run_semaphore_store);
+static DEVICE_ATTR(run_mutex, S_IRUGO | S_IWUSR | S_IWGRP, run_mutex_show, run_mutex_store);
 static DEVICE_ATTR(iters, S_IRUGO | S_IWUSR | S_IWGRP, iters_show, iters_store);
 static DEVICE_ATTR(threads, S_IRUGO | S_IWUSR | S_IWGRP, threads_show, threads_store);
+static DEVICE_ATTR(oversubscribe, S_IRUGO | S_IWUSR | S_IWGRP, oversubscribe_show, oversubscribe_store);
+static DEVICE_ATTR(fifo_threads, S_IRUGO | S_IWUSR | S_IWGRP, fifo_threads_show, fifo_threads_store);
+static DEVICE_ATTR(preempt_every, S_IRUGO | S_IWUSR | S_IWGRP, preempt_every_show, preempt_every_store);
+static DEVICE_ATTR(preempt_us, S_IRUGO | S_IWUSR | S_IWGRP, preempt_us_show, preempt_us_store);
+static DEVICE_ATTR(result, S_IRUGO, result_show, NULL);
 static DEVICE_ATTR(run_basic, S_IRUGO, run_basic_show, NULL);
 static DEVICE_ATTR(locktest_counter, S_IRUGO, locktest_counter_show, NULL);
 
 static struct attribute *locktest_attr[] = {
     &dev_attr_run_spinlock.attr,
     &dev_attr_run_semaphore.attr,
+    &dev_attr_run_mutex.attr,
     &dev_attr_run_basic.attr,
     &dev_attr_iters.attr,
     &dev_attr_threads.attr,
+    &dev_attr_oversubscribe.attr,
+    &dev_attr_fifo_threads.attr,
+    &dev_attr_preempt_every.attr,
+    &dev_attr_preempt_us.attr,
+    &dev_attr_result.attr,
     &dev_attr_locktest_counter.attr,
     NULL
 };
@@ -385,6 +791,10 @@ static int __init locktest_init(void)
         goto sysfs_failed;
     }
 
+    /* Records are optional, the tests run without debugfs */
+    locktest_debugfs = debugfs_create_dir("locktest", NULL);
+    debugfs_create_file("results", 0600, locktest_debugfs, NULL, &locktest_records_fops);
+
     return 0;
 
 sysfs_failed:
@@ -396,6 +806,7 @@ exit:
 
 static void __exit locktest_exit(void)
 {
+    debugfs_remove_recursive(locktest_debugfs);
     device_unregister(&locktest_device);
 }
 
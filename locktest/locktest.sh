@@ -1,5 +1,9 @@
 #!/bin/bash
 
+# JSON lines result records of all runs are appended here
+RESULTS=${RESULTS:-locktest.jsonl}
+DEBUGFS_RESULTS=/sys/kernel/debug/locktest/results
+
 locktest() {
 
     insmod locktest.ko
@@ -53,6 +57,56 @@ locktest() {
 
     echo "locking_spinlock_time;$spinlock_test_time"
     echo "locking_sempahore_time;$semaphore_test_time"
+
+    contention_sweep || return 1
+
+    if [[ -r $DEBUGFS_RESULTS ]]; then
+        cat $DEBUGFS_RESULTS >> "$RESULTS"
+        echo "results appended to $RESULTS"
+    fi
+}
+
+# field <name> of the last run from /sys/devices/locktest/result
+result_field() {
+    awk -v name=$1 '{ for (i = 1; i < NF; i++) if ($i == name) print $(i + 1) }' \
+        /sys/devices/locktest/result
+}
+
+# Oversubscription and lock holder preemption: 1, 2 and 4 kthreads per cpu,
+# all normal or one SCHED_FIFO per cpu, holder preempted or not. Look for
+# ops_per_sec collapsing and wait_max_ns exploding relative to x1_fifo0_preempt0.
+contention_sweep() {
+    local ncpus=$(cat /sys/devices/locktest/threads)
+    local prim per_cpu fifo preempt name
+
+    printf 20000 > /sys/devices/locktest/iters
+    printf 50 > /sys/devices/locktest/preempt_us
+
+    echo "Running ... contention sweep, iterations $(cat /sys/devices/locktest/iters), cpus $ncpus"
+
+    for prim in spinlock semaphore mutex; do
+        for per_cpu in 1 2 4; do
+            for fifo in 0 $ncpus; do
+                for preempt in 0 1; do
+                    printf $per_cpu > /sys/devices/locktest/oversubscribe
+                    printf $fifo > /sys/devices/locktest/fifo_threads
+                    printf $((preempt ? 64 : 0)) > /sys/devices/locktest/preempt_every
+                    echo test > /sys/devices/locktest/run_$prim
+                    if (($? != 0)); then
+                        echo "Failed to run locktest-$prim x$per_cpu fifo $fifo preempt $preempt"
+                        return 1
+                    fi
+                    name=locking_${prim}_x${per_cpu}_fifo${fifo}_preempt${preempt}
+                    echo "${name}_ops_per_sec;$(result_field ops_per_sec)"
+                    echo "${name}_wait_max_ns;$(result_field wait_max_ns)"
+                done
+            done
+        done
+    done
+
+    printf 1 > /sys/devices/locktest/oversubscribe
+    printf 0 > /sys/devices/locktest/fifo_threads
+    printf 0 > /sys/devices/locktest/preempt_every
 }
 
 # main
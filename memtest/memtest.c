@@ -7,6 +7,14 @@
  *
  * In case of CONFIG_HIGHMEM, memory test will go through
  * HighMem, LowMem (Slab) and Vmalloc memory.
+ *
+ * With @coverage_file set, every frame that passed all runs is stamped in a
+ * per PFN coverage map kept in that file across module loads. With
+ * @prefer_stale on top, only frames never verified or verified more than
+ * @stale_hours ago are tested, at most @stale_budget MB of them per load, so
+ * repeated short windows reach all of memory:
+ *
+ *   insmod memtest.ko coverage_file=/var/lib/memtest.cov prefer_stale=1
  */
 #include <linux/kernel.h>
 #include <linux/version.h>
@@ -16,6 +24,13 @@
 #include <linux/delay.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/utsname.h>
+#include <linux/nodemask.h>
+#include <linux/mutex.h>
 #include <asm/io.h>
 
 #undef pr_fmt
@@ -30,6 +45,10 @@
 static struct memtest {
 	char *test_area;
 	u64 test_area_size;
+	/* scan_mem() totals of the current test for its result record */
+	u64 scanned;
+	u64 scan_ns;
+	u64 errors;
 } mt;
 
 static unsigned int free_sysmem_space = 100;
@@ -78,6 +97,57 @@ static bool stop_test;
 module_param(stop_test, bool, 0644);
 MODULE_PARM_DESC(stop_test, "Interrupt test by passing 1");
 
+static char *coverage_file;
+module_param(coverage_file, charp, 0444);
+MODULE_PARM_DESC(coverage_file,
+		 "File keeping the PFN coverage map across runs, default is none");
+
+static bool prefer_stale;
+module_param(prefer_stale, bool, 0644);
+MODULE_PARM_DESC(prefer_stale,
+		 "Test only untested or stale frames from coverage_file, default is 0");
+
+static unsigned int stale_hours = 168;
+module_param(stale_hours, uint, 0644);
+MODULE_PARM_DESC(stale_hours,
+		 "Frames verified longer ago than this are stale, default is 168");
+
+static unsigned int stale_budget = 256;
+module_param(stale_budget, uint, 0644);
+MODULE_PARM_DESC(stale_budget,
+		 "Stale memory (in MB) tested per load with prefer_stale, default is 256");
+
+#define COVERAGE_MAGIC 0x5643544d	/* "MTCV" */
+#define COVERAGE_VERSION 1
+#define COVERAGE_GROW_PFNS (1UL << 18)
+
+/* coverage_file is this header followed by nr_pfns u16 stamps */
+struct coverage_hdr {
+	u32 magic;
+	u32 version;
+	u64 base;	/* real time in seconds the stamps count hours from */
+	u64 nr_pfns;
+};
+
+#define RECORD_MAX 1024
+#define RECORDS_SIZE (8 * 1024)
+
+/*
+ * Result records of the tests of this load, one JSON object per line,
+ * read through debugfs memtest/results. Same fields as locktest and
+ * l2_packet_sender, see results/compare_results.py.
+ */
+static DEFINE_MUTEX(records_lock);
+static char records[RECORDS_SIZE];
+static size_t records_len;
+static struct dentry *memtest_debugfs;
+
+static struct coverage {
+	struct coverage_hdr hdr;
+	u16 *stamp;	/* hours since hdr.base + 1, 0 is never verified */
+	u16 now;	/* stamp of this load, 0 if coverage is off */
+} cov;
+
 
 static void meminfo_show(const char *info)
 {
@@ -142,8 +212,194 @@ static void dump_mem_addr(struct memtest *mt, char *info)
 		 addr_info, get_phys_addr(mt->test_area), mt->test_area);
 }
 
+static int coverage_grow(u64 pfn)
+{
+	u64 nr_pfns = round_up(pfn + 1, COVERAGE_GROW_PFNS);
+	u16 *stamp;
+
+	stamp = vzalloc(nr_pfns * sizeof(*stamp));
+	if (!stamp)
+		return -ENOMEM;
+
+	if (cov.stamp) {
+		memcpy(stamp, cov.stamp, cov.hdr.nr_pfns * sizeof(*stamp));
+		vfree(cov.stamp);
+	}
+	cov.stamp = stamp;
+	cov.hdr.nr_pfns = nr_pfns;
+
+	return 0;
+}
+
+static void coverage_mark_pfn(u64 pfn)
+{
+	if (!cov.now)
+		return;
+
+	if (pfn >= cov.hdr.nr_pfns && coverage_grow(pfn)) {
+		pr_emerg("unable to grow coverage map to PFN 0x%llx\n", pfn);
+		return;
+	}
+	cov.stamp[pfn] = cov.now;
+}
+
+static void coverage_mark_area(char *addr, u64 size)
+{
+	u64 off;
+
+	if (!cov.now)
+		return;
+
+	for (off = 0; off < size; off += PAGE_SIZE)
+		coverage_mark_pfn(PHYS_PFN(get_phys_addr(addr + off)));
+}
+
+static bool coverage_is_stale(u64 pfn)
+{
+	if (pfn >= cov.hdr.nr_pfns || !cov.stamp[pfn])
+		return true;
+	/* Stamped in the future, the clock went back since: age unknown */
+	if (cov.stamp[pfn] > cov.now)
+		return true;
+
+	return cov.now - cov.stamp[pfn] >= stale_hours;
+}
+
+/* Reads or writes all of @count, kernel_read/kernel_write may do less */
+static int coverage_io(struct file *f, void *buf, size_t count, loff_t *pos,
+		       bool write)
+{
+	ssize_t ret;
+
+	while (count) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 14, 0)
+		ret = write ? kernel_write(f, buf, count, *pos) :
+			      kernel_read(f, *pos, buf, count);
+		if (ret > 0)
+			*pos += ret;
+#else
+		ret = write ? kernel_write(f, buf, count, pos) :
+			      kernel_read(f, buf, count, pos);
+#endif
+		if (ret <= 0)
+			return ret < 0 ? ret : -EIO;
+		buf += ret;
+		count -= ret;
+	}
+
+	return 0;
+}
+
+static int coverage_load(void)
+{
+	time64_t now = ktime_get_real_seconds();
+	struct file *f;
+	loff_t pos = 0;
+	int ret = 0;
+
+	f = filp_open(coverage_file, O_RDONLY, 0);
+	if (IS_ERR(f)) {
+		if (PTR_ERR(f) != -ENOENT) {
+			pr_emerg("unable to open coverage map %s\n",
+				 coverage_file);
+			return PTR_ERR(f);
+		}
+		pr_emerg("starting new coverage map %s\n", coverage_file);
+		cov.hdr.magic = COVERAGE_MAGIC;
+		cov.hdr.version = COVERAGE_VERSION;
+		cov.hdr.base = now;
+		cov.hdr.nr_pfns = 0;
+		goto stamp;
+	}
+
+	if (coverage_io(f, &cov.hdr, sizeof(cov.hdr), &pos, false) ||
+	    cov.hdr.magic != COVERAGE_MAGIC ||
+	    cov.hdr.version != COVERAGE_VERSION ||
+	    i_size_read(file_inode(f)) !=
+	    sizeof(cov.hdr) + cov.hdr.nr_pfns * sizeof(*cov.stamp)) {
+		pr_emerg("%s is no memtest coverage map\n", coverage_file);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (cov.hdr.nr_pfns) {
+		cov.stamp = vmalloc(cov.hdr.nr_pfns * sizeof(*cov.stamp));
+		if (!cov.stamp) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ret = coverage_io(f, cov.stamp,
+				  cov.hdr.nr_pfns * sizeof(*cov.stamp),
+				  &pos, false);
+		if (ret < 0) {
+			pr_emerg("unable to read coverage map %s\n",
+				 coverage_file);
+			goto out;
+		}
+	}
+
+out:
+	filp_close(f, NULL);
+	if (ret < 0)
+		return ret;
+
+stamp:
+	if (now < cov.hdr.base)
+		cov.now = 1;
+	else
+		cov.now = min_t(u64, div_u64(now - cov.hdr.base, 3600) + 1,
+				U16_MAX);
+
+	return 0;
+}
+
+static int coverage_save(void)
+{
+	struct file *f;
+	loff_t pos = 0;
+	int ret;
+
+	f = filp_open(coverage_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (IS_ERR(f)) {
+		pr_emerg("unable to write coverage map %s\n", coverage_file);
+		return PTR_ERR(f);
+	}
+
+	ret = coverage_io(f, &cov.hdr, sizeof(cov.hdr), &pos, true);
+	if (!ret && cov.hdr.nr_pfns)
+		ret = coverage_io(f, cov.stamp,
+				  cov.hdr.nr_pfns * sizeof(*cov.stamp),
+				  &pos, true);
+	if (ret < 0)
+		pr_emerg("unable to write coverage map %s\n", coverage_file);
+
+	filp_close(f, NULL);
+
+	return ret;
+}
+
+static void coverage_show(void)
+{
+	u64 pfn, verified = 0, fresh = 0;
+	struct sysinfo si;
+
+	si_meminfo(&si);
+	for (pfn = 0; pfn < cov.hdr.nr_pfns; pfn++) {
+		if (!cov.stamp[pfn])
+			continue;
+		verified++;
+		if (!coverage_is_stale(pfn))
+			fresh++;
+	}
+
+	pr_emerg("coverage: %llu MB of %llu MB verified, %llu MB within the last %u hours\n",
+		 PAGES_TO_MB(verified), PAGES_TO_MB(si.totalram),
+		 PAGES_TO_MB(fresh), stale_hours);
+}
+
 static int scan_mem(struct memtest *mt)
 {
+	u64 start = ktime_get_ns();
 	int ret = 0;
 	u64 i = 0;
 
@@ -156,13 +412,114 @@ static int scan_mem(struct memtest *mt)
 				 (mt->test_area + i));
 
 			ret = -EILSEQ;
+			mt->errors++;
 		}
 		i++;
 	}
+	mt->scanned += i;
+	mt->scan_ns += ktime_get_ns() - start;
 
 	return ret;
 }
 
+static u64 memtest_begin(void)
+{
+	mt.scanned = 0;
+	mt.scan_ns = 0;
+	mt.errors = 0;
+
+	return ktime_get_ns();
+}
+
+/* @str as the inside of a JSON string, into @buf of @size bytes */
+static const char *json_escape(char *buf, size_t size, const char *str)
+{
+	size_t len = 0;
+
+	for (; *str && len + 7 <= size; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			len += snprintf(buf + len, size - len, "\\%c", c);
+		else if (c < 0x20)
+			len += snprintf(buf + len, size - len, "\\u%04x", c);
+		else
+			buf[len++] = c;
+	}
+	buf[len] = '\0';
+
+	return buf;
+}
+
+/*
+ * Result record of the test started at @start_ns on @size bytes, also in
+ * the kernel log since the module is gone again after a failed test.
+ * @size follows the memory available at load time, so it is a metric and
+ * params only hold the settings records are compared by.
+ */
+static void memtest_record(const char *mode, u64 size, u64 start_ns)
+{
+	/* Escaped worst case, static as they are only used under the lock */
+	static char nodename[__NEW_UTS_LEN * 6 + 1], release[__NEW_UTS_LEN * 6 + 1];
+	char *rec;
+	int len;
+
+	mutex_lock(&records_lock);
+	if (RECORDS_SIZE - records_len < RECORD_MAX) {
+		mutex_unlock(&records_lock);
+		pr_emerg("no room for %s result record\n", mode);
+		return;
+	}
+
+	rec = records + records_len;
+	len = snprintf(rec, RECORD_MAX,
+		 "{\"tool\": \"memtest\", \"mode\": \"%s\", "
+		 "\"params\": {\"runs\": %u, \"pattern\": %u, \"pause_s\": %u, "
+		 "\"prefer_stale\": %d, \"stale_hours\": %u, \"stale_budget_mb\": %u}, "
+		 "\"host\": {\"hostname\": \"%s\", \"kernel\": \"%s\", \"cpus\": %u, \"nodes\": %u}, "
+		 "\"time\": %lld, \"duration_ns\": %llu, "
+		 "\"throughput\": %llu, \"throughput_unit\": \"MB/s\", \"errors\": %llu, "
+		 "\"metrics\": {\"size_mb\": %llu, \"scanned_mb\": %llu, \"interrupted\": %d}}\n",
+		 mode, max_runs, test_pattern, pause_time,
+		 prefer_stale, stale_hours, stale_budget,
+		 json_escape(nodename, sizeof(nodename), utsname()->nodename),
+		 json_escape(release, sizeof(release), utsname()->release),
+		 num_online_cpus(),
+		 num_online_nodes(), (long long)ktime_get_real_seconds(),
+		 ktime_get_ns() - start_ns,
+		 mt.scan_ns ? div64_u64(BYTE_TO_MB(mt.scanned) * NSEC_PER_SEC, mt.scan_ns) : 0,
+		 mt.errors, BYTE_TO_MB(size), BYTE_TO_MB(mt.scanned), stop_test);
+	if (len >= RECORD_MAX) {
+		/* Cut short it would merge with the next record */
+		rec[0] = '\0';
+		mutex_unlock(&records_lock);
+		pr_emerg("%s result record too long, dropped\n", mode);
+		return;
+	}
+	records_len += len;
+	mutex_unlock(&records_lock);
+
+	pr_emerg("result: %s", rec);
+}
+
+static ssize_t records_read(struct file *file, char __user *buf, size_t count,
+			    loff_t *ppos)
+{
+	ssize_t ret;
+
+	mutex_lock(&records_lock);
+	ret = simple_read_from_buffer(buf, count, ppos, records, records_len);
+	mutex_unlock(&records_lock);
+
+	return ret;
+}
+
+static const struct file_operations records_fops = {
+	.owner = THIS_MODULE,
+	.read = records_read,
+	.llseek = default_llseek,
+};
+
 static void sleep_and_check_testrun_state(int *fail)
 {
 	msleep(pause_time * 1000);
@@ -178,9 +535,10 @@ static int test_highmem_arch(void)
 	struct sysinfo si;
 	int ret = 0, fail = 0;
 	u64 page_count = 0, i = 0, j = 0;
-	u64 alloc_total_mem = 0;
+	u64 alloc_total_mem = 0, start_ns;
 
 	pr_emerg("++++++++++ Testing HighMem ++++++++++\n");
+	start_ns = memtest_begin();
 	si_meminfo(&si);
 
 	if (MB_TO_BYTE(free_sysmem_space) > PAGES_TO_BYTE(si.freehigh)) {
@@ -241,10 +599,15 @@ static int test_highmem_arch(void)
 		sleep_and_check_testrun_state(&fail);
 	}
 
+	if (j == max_runs && fail == 0)
+		for (i = 0; i < page_count; i++)
+			coverage_mark_pfn(page_to_pfn(pg[i]));
+
 	for (i = 0; i < page_count; i++)
 		__free_page(pg[i]);
 
 	vfree(pg);
+	memtest_record("highmem", alloc_total_mem, start_ns);
 	ret = fail;
 
 	return ret;
@@ -256,9 +619,10 @@ static int test_slab_on_highmem_arch(void)
 	char **page_list;
 	int ret = 0, fail = 0;
 	u64 page_count = 0, i = 0, j = 0;
-	u64 alloc_total_mem = 0;
+	u64 alloc_total_mem = 0, start_ns;
 
 	pr_emerg("++++++++++ Testing Slab memory ++++++++++\n");
+	start_ns = memtest_begin();
 	mt.test_area_size = PAGE_SIZE;
 
 	si_meminfo(&si);
@@ -312,10 +676,15 @@ static int test_slab_on_highmem_arch(void)
 		sleep_and_check_testrun_state(&fail);
 	}
 
+	if (j == max_runs && fail == 0)
+		for (i = 0; i < page_count; i++)
+			coverage_mark_area(page_list[i], mt.test_area_size);
+
 	for (i = 0; i < page_count; i++)
 		kfree(page_list[i]);
 
 	vfree(page_list);
+	memtest_record("slab", alloc_total_mem, start_ns);
 	ret = fail;
 
 	return ret;
@@ -325,7 +694,7 @@ static int test_vmalloc_on_highmem_arch(void)
 {
 	char **vm_list;
 	int ret = 0, fail = 0;
-	u64 vm_count = 0, i = 0, j = 0;
+	u64 vm_count = 0, i = 0, j = 0, start_ns;
 
 	/*
 	 * We cannot get on all kernel versions VmallocUsed.
@@ -338,6 +707,7 @@ static int test_vmalloc_on_highmem_arch(void)
 	 */
 
 	pr_emerg("++++++++++ Testing Vmalloc memory ++++++++++\n");
+	start_ns = memtest_begin();
 	mt.test_area_size = MB_TO_BYTE(1);
 
 	vm_list = kmalloc_array(BYTE_TO_MB(VMALLOC_TOTAL), sizeof(char *),
@@ -389,6 +759,12 @@ static int test_vmalloc_on_highmem_arch(void)
 		sleep_and_check_testrun_state(&fail);
 	}
 
+	if (j == max_runs && fail == 0)
+		for (i = 0; i < vm_count; i++)
+			coverage_mark_area(vm_list[i], mt.test_area_size);
+
+	memtest_record("vmalloc", vm_count * mt.test_area_size, start_ns);
+
 out:
 	for (i = 0; i < vm_count; i++)
 		vfree(vm_list[i]);
@@ -402,7 +778,7 @@ out:
 static int test_mem(void)
 {
 	int ret = 0, fail = 0;
-	u64 i = 0;
+	u64 i = 0, start_ns;
 
 	if (MB_TO_BYTE(free_sysmem_space) > PAGES_TO_BYTE(si_mem_available())) {
 		pr_emerg("Not enough memory to test!\n");
@@ -412,6 +788,7 @@ static int test_mem(void)
 	mt.test_area_size = PAGES_TO_BYTE(si_mem_available()) -
 			    MB_TO_BYTE(free_sysmem_space);
 
+	start_ns = memtest_begin();
 	pr_emerg("allocating %llu MB for test\n",
 		 BYTE_TO_MB(mt.test_area_size));
 	mt.test_area = vmalloc(mt.test_area_size);
@@ -434,7 +811,93 @@ static int test_mem(void)
 
 		sleep_and_check_testrun_state(&fail);
 	}
+	if (i == max_runs && fail == 0)
+		coverage_mark_area(mt.test_area, mt.test_area_size);
 	vfree(mt.test_area);
+	memtest_record("mem", mt.test_area_size, start_ns);
+	ret = fail;
+
+	return ret;
+}
+
+/*
+ * The allocator cannot be asked for particular frames. Pages are taken until
+ * @stale_budget MB of stale ones are found, the fresh ones are held back
+ * meanwhile so the allocator hands out others, and freed before testing.
+ */
+static int test_stale_frames(void)
+{
+	struct page **pg, *page;
+	unsigned long *bad;
+	int ret = 0, fail = 0;
+	u64 limit = 0, budget = 0, stale = 0, held = 0, i = 0, j = 0, start_ns;
+
+	pr_emerg("++++++++++ Testing stale frames ++++++++++\n");
+	start_ns = memtest_begin();
+
+	if (MB_TO_BYTE(free_sysmem_space) > PAGES_TO_BYTE(si_mem_available())) {
+		pr_emerg("Not enough memory to test!\n");
+		return -ENOMEM;
+	}
+
+	limit = si_mem_available() - (MB_TO_BYTE(free_sysmem_space) >> PAGE_SHIFT);
+	budget = min_t(u64, limit, MB_TO_BYTE(stale_budget) >> PAGE_SHIFT);
+	mt.test_area_size = PAGE_SIZE;
+
+	/* stale pages fill pg from the front, held back fresh ones from the end */
+	pg = vmalloc(limit * sizeof(*pg));
+	bad = vzalloc(BITS_TO_LONGS(budget) * sizeof(long));
+	if (!pg || !bad) {
+		pr_emerg("unable to vmalloc page list\n");
+		vfree(pg);
+		vfree(bad);
+		return -ENOMEM;
+	}
+
+	while (stale < budget && stale + held < limit && !stop_test) {
+		page = alloc_page(GFP_HIGHUSER | __GFP_NOWARN | __GFP_NORETRY);
+		if (!page)
+			break;
+		if (coverage_is_stale(page_to_pfn(page)))
+			pg[stale++] = page;
+		else
+			pg[limit - ++held] = page;
+	}
+
+	for (i = limit - held; i < limit; i++)
+		__free_page(pg[i]);
+
+	pr_emerg("testing %llu MB stale frames, skipped %llu MB verified within %u hours\n",
+		 PAGES_TO_MB(stale), PAGES_TO_MB(held), stale_hours);
+
+	for (j = 0; j < max_runs && !stop_test; j++) {
+		pr_emerg("starting test %llu of %d\n", j + 1, max_runs);
+		for (i = 0; i < stale && !stop_test; i++) {
+			mt.test_area = kmap(pg[i]);
+			if (j == 0)
+				memset(mt.test_area, test_pattern,
+				       mt.test_area_size);
+			ret = scan_mem(&mt);
+			kunmap(pg[i]);
+			if (ret < 0) {
+				fail = ret;
+				__set_bit(i, bad);
+			}
+		}
+		sleep_and_check_testrun_state(&fail);
+	}
+
+	if (j == max_runs)
+		for (i = 0; i < stale; i++)
+			if (!test_bit(i, bad))
+				coverage_mark_pfn(page_to_pfn(pg[i]));
+
+	for (i = 0; i < stale; i++)
+		__free_page(pg[i]);
+
+	vfree(bad);
+	vfree(pg);
+	memtest_record("stale", PAGES_TO_BYTE(stale), start_ns);
 	ret = fail;
 
 	return ret;
@@ -444,9 +907,24 @@ static int memtest_init(void)
 {
 	int ret = 0, fail = 0;
 
+	if (coverage_file && *coverage_file) {
+		ret = coverage_load();
+		if (ret < 0)
+			return ret;
+	} else if (prefer_stale) {
+		pr_emerg("prefer_stale needs coverage_file!\n");
+		return -EINVAL;
+	}
+
+	/* Records are optional, the test runs without debugfs */
+	memtest_debugfs = debugfs_create_dir("memtest", NULL);
+	debugfs_create_file("results", 0400, memtest_debugfs, NULL, &records_fops);
+
 	meminfo_show("Meminfo before test");
 
-	if (IS_ENABLED(CONFIG_HIGHMEM)) {
+	if (prefer_stale) {
+		fail = test_stale_frames();
+	} else if (IS_ENABLED(CONFIG_HIGHMEM)) {
 		if (test_highmem && !stop_test) {
 			ret = test_highmem_arch();
 			if (ret < 0)
@@ -467,16 +945,25 @@ static int memtest_init(void)
 
 	meminfo_show("Meminfo after test");
 
+	if (cov.now) {
+		coverage_show();
+		coverage_save();
+		vfree(cov.stamp);
+	}
+
 	if (stop_test) {
 		pr_emerg("Test interrupted!\n");
+		debugfs_remove_recursive(memtest_debugfs);
 		return -EAGAIN;
 	}
 
 	ret = fail;
-	if (ret == 0)
+	if (ret == 0) {
 		pr_emerg("SUCCESS - test ends!\n");
-	else
+	} else {
 		pr_emerg("FAILED - test ends!\n");
+		debugfs_remove_recursive(memtest_debugfs);
+	}
 
 	return ret;
 }
@@ -484,5 +971,6 @@ module_init(memtest_init);
 
 static void __exit memtest_exit(void)
 {
+	debugfs_remove_recursive(memtest_debugfs);
 }
 module_exit(memtest_exit);
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''
+Compare two sets of result records and flag regressions.
+
+Every benchmark of this repo writes the same result record, one JSON object
+per line:
+
+  locktest            debugfs locktest/results, collected by locktest.sh
+  memtest             debugfs memtest/results, and "result:" kernel log lines
+  l2_packet_sender    --json FILE
+  l2_packet_receiver  --json FILE
+
+Fields:
+
+  tool             name of the tool
+  mode             what was measured, e.g. the lock primitive or sender engine
+  params           object of the parameters of the run
+  host             hostname, kernel, cpus and nodes (NUMA) of the machine
+  time             end of the run, seconds since the epoch
+  duration_ns      run time
+  throughput       higher is better, in throughput_unit
+  throughput_unit  e.g. "ops/s", "pps", "MB/s"
+  latency_ns       optional, any of min, avg, p50, p90, p99, max
+  errors           anything that went wrong, e.g. send errors or bad bytes
+  metrics          optional, tool specific numbers
+
+Records of the same tool, mode and params are compared, the median of
+repeated runs on each side. Throughput dropping or p50/p99 latency rising by
+more than the threshold, and errors rising at all, are regressions. Lines
+that do not start with '{' are searched for one, so kernel log lines can be
+fed in as they are:
+
+  compare_results.py baseline.jsonl candidate.jsonl
+  dmesg | grep 'memtest: result:' > candidate.jsonl
+
+Exits with 1 when there is a regression.
+'''
+import argparse
+import json
+import statistics
+import sys
+
+LATENCIES = ('p50', 'p99')
+
+def load(path):
+    records = {}
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            start = line.find('{')
+            if start < 0:
+                continue
+            try:
+                rec = json.loads(line[start:])
+            except ValueError as e:
+                sys.stderr.write('%s:%d: %s\n' % (path, lineno, e))
+                continue
+            key = (rec.get('tool'), rec.get('mode'),
+                   json.dumps(rec.get('params', {}), sort_keys=True))
+            records.setdefault(key, []).append(rec)
+    return records
+
+def median(records, get):
+    values = [v for v in (get(r) for r in records) if v is not None]
+    return statistics.median(values) if values else None
+
+def summarize(records):
+    summary = {
+        'n': len(records),
+        'unit': records[-1].get('throughput_unit', ''),
+        'throughput': median(records, lambda r: r.get('throughput')),
+        'errors': median(records, lambda r: r.get('errors')),
+    }
+    for p in LATENCIES:
+        summary[p] = median(records, lambda r: r.get('latency_ns', {}).get(p))
+    return summary
+
+def change(old, new):
+    if old is None or new is None:
+        return None
+    if old == 0:
+        return 0.0 if new == 0 else float('inf')
+    return 100.0 * (new - old) / old
+
+def compare(old, new, threshold, latency_threshold):
+    '''
+    Returns (verdict, notes) of one key, verdict being 'regression',
+    'improved' or 'ok'.
+    '''
+    notes = []
+    regressed = improved = False
+
+    pct = change(old['throughput'], new['throughput'])
+    if pct is not None:
+        notes.append('throughput %.4g -> %.4g %s (%+.1f%%)' %
+                     (old['throughput'], new['throughput'], new['unit'], pct))
+        regressed |= pct < -threshold
+        improved |= pct > threshold
+
+    for p in LATENCIES:
+        pct = change(old[p], new[p])
+        if pct is None:
+            continue
+        notes.append('%s %d -> %d ns (%+.1f%%)' % (p, old[p], new[p], pct))
+        regressed |= pct > latency_threshold
+        improved |= pct < -latency_threshold
+
+    if old['errors'] is not None and new['errors'] is not None:
+        if new['errors'] != old['errors']:
+            notes.append('errors %d -> %d' % (old['errors'], new['errors']))
+        regressed |= new['errors'] > old['errors']
+
+    if regressed:
+        return 'regression', notes
+    return ('improved' if improved else 'ok'), notes
+
+def describe(key):
+    tool, mode, params = key
+    params = json.loads(params)
+    return '%s %s %s' % (tool, mode, ' '.join('%s=%s' % kv for kv in sorted(params.items())))
+
+def main():
+    parser = argparse.ArgumentParser(prog='compare_results',
+                                     description='Flags regressions between two sets of result records.')
+    parser.add_argument('baseline', help='JSON lines result records before the change')
+    parser.add_argument('candidate', help='JSON lines result records after the change')
+    parser.add_argument('-t', '--threshold', type=float, default=5.0,
+                        help='throughput change in percent that counts, default 5')
+    parser.add_argument('-l', '--latency-threshold', type=float, default=10.0,
+                        help='latency change in percent that counts, default 10')
+    parser.add_argument('-a', '--all', action='store_true',
+                        help='also list unchanged results')
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    candidate = load(args.candidate)
+
+    counts = {'regression': 0, 'improved': 0, 'ok': 0}
+    for key in sorted(set(baseline) | set(candidate), key=lambda k: tuple(map(str, k))):
+        if key not in candidate:
+            print('MISSING     %s' % describe(key))
+            continue
+        if key not in baseline:
+            print('NEW         %s' % describe(key))
+            continue
+        old, new = summarize(baseline[key]), summarize(candidate[key])
+        verdict, notes = compare(old, new, args.threshold, args.latency_threshold)
+        counts[verdict] += 1
+        if verdict == 'ok' and not args.all:
+            continue
+        print('%-11s %s (%d vs %d runs)' % (verdict.upper(), describe(key), old['n'], new['n']))
+        for note in notes:
+            print('              %s' % note)
+
+    print('%d regressions, %d improved, %d unchanged' %
+          (counts['regression'], counts['improved'], counts['ok']))
+    sys.exit(1 if counts['regression'] else 0)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,154 @@
+#!/bin/bash
+#
+# Benchmark l2_packet_sender over a veth pair between two network
+# namespaces, so it runs on any Linux box without real NICs. Every
+# available sender mode is run across frame sizes from 64 bytes to the
+# MTU, the receiver counts what actually arrived, and one CSV line is
+# written per run:
+#
+#   mode,frame_size,sent,received,lost,loss_pct,pps,gbps,cpu_ns_per_pkt
+#
+# The JSON lines result records of sender and receiver go next to it, into
+# output.jsonl, for results/compare_results.py.
+#
+# usage: l2_bench.sh [output.csv]     (as root)
+#
+# Tunables from the environment: COUNT, MTU, SIZES, MODES, SENDER, RECEIVER.
+
+COUNT=${COUNT:-200000}
+MTU=${MTU:-1500}
+# frame sizes without FCS, the Ethernet header (14 bytes) included
+SIZES=${SIZES:-"64 128 256 512 1024 $((MTU + 14))"}
+MODES=${MODES:-"sendto batch xdp uring"}
+OUTPUT=${1:-l2_bench.csv}
+RESULTS=${OUTPUT%.csv}.jsonl
+
+NS_TX=l2bench_tx
+NS_RX=l2bench_rx
+DEV_TX=l2b0
+DEV_RX=l2b1
+
+SRCDIR=$(cd "$(dirname "$0")" && pwd)
+WORKDIR=$(mktemp -d /tmp/l2_bench.XXXXXX)
+
+err() {
+    echo "ERROR! --> $@" 1>&2
+}
+
+cleanup() {
+    ip netns del $NS_TX &>/dev/null
+    ip netns del $NS_RX &>/dev/null
+    rm -rf "$WORKDIR"
+}
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+build() {
+    if [[ -z "$SENDER" ]]; then
+        SENDER="$WORKDIR/l2_packet_sender"
+        if ! gcc -O2 -pthread -o "$SENDER" "$SRCDIR/l2_packet_sender.c"; then
+            err "cannot build l2_packet_sender"
+            return 1
+        fi
+    fi
+    if [[ -z "$RECEIVER" ]]; then
+        RECEIVER="$WORKDIR/l2_packet_receiver"
+        if ! gcc -O2 -o "$RECEIVER" "$SRCDIR/l2_packet_receiver.c"; then
+            err "cannot build l2_packet_receiver"
+            return 1
+        fi
+    fi
+}
+
+setup() {
+    ip netns del $NS_TX &>/dev/null
+    ip netns del $NS_RX &>/dev/null
+    ip netns add $NS_TX && ip netns add $NS_RX &&
+        ip link add $DEV_TX netns $NS_TX type veth peer name $DEV_RX netns $NS_RX &&
+        ip -n $NS_TX link set $DEV_TX mtu $MTU up &&
+        ip -n $NS_RX link set $DEV_RX mtu $MTU up
+    if (($? != 0)); then
+        err "cannot create namespaces and veth pair"
+        return 1
+    fi
+}
+
+# sender options of each mode
+mode_args() {
+    case $1 in
+    sendto) echo "--batch 1" ;;
+    batch) echo "--batch 64" ;;
+    xdp) echo "--batch 64 --engine xdp" ;;
+    uring) echo "--batch 64 --engine uring" ;;
+    *) return 1 ;;
+    esac
+}
+
+# run_one <mode> <frame size>, appends one CSV line
+run_one() {
+    local mode=$1 size=$2
+    local args
+    args=$(mode_args $mode) || {
+        err "unknown mode $mode"
+        return 1
+    }
+
+    ip netns exec $NS_RX "$RECEIVER" -I $DEV_RX --json "$RESULTS" >"$WORKDIR/rx.log" 2>&1 &
+    local rx_pid=$!
+    # let the receiver set up its ring before the first frame
+    sleep 0.5
+
+    ip netns exec $NS_TX "$SENDER" -I $DEV_TX -i 0 -c $COUNT -s $((size - 14)) $args \
+        --json "$RESULTS" >"$WORKDIR/tx.log" 2>&1
+    local tx_ret=$?
+
+    sleep 0.5
+    kill -INT $rx_pid
+    wait $rx_pid
+
+    if ((tx_ret != 0)); then
+        echo "  $mode $size: sender failed, skipped"
+        sed 's/^/    /' "$WORKDIR/tx.log" | tail -n 3
+        return 0
+    fi
+
+    local sent pps gbps cpu received
+    sent=$(sed -n 's/^sent \([0-9]*\) packets.*/\1/p' "$WORKDIR/tx.log")
+    pps=$(sed -n 's/^rate achieved \([0-9]*\) pps, \([0-9.]*\) Gbit.*/\1/p' "$WORKDIR/tx.log")
+    gbps=$(sed -n 's/^rate achieved \([0-9]*\) pps, \([0-9.]*\) Gbit.*/\2/p' "$WORKDIR/tx.log")
+    cpu=$(sed -n 's/^cpu \([0-9.]*\) s.*/\1/p' "$WORKDIR/tx.log")
+    received=$(sed -n 's/^total: received \([0-9]*\),.*/\1/p' "$WORKDIR/rx.log")
+    received=${received:-0}
+
+    awk -v mode=$mode -v size=$size -v sent=$sent -v received=$received \
+        -v pps=$pps -v gbps=$gbps -v cpu=$cpu 'BEGIN {
+        lost = sent > received ? sent - received : 0
+        printf "%s,%d,%d,%d,%d,%.4f,%d,%.3f,%.1f\n", mode, size, sent, received, lost,
+               sent ? 100 * lost / sent : 0, pps, gbps, sent ? cpu * 1e9 / sent : 0
+    }' | tee -a "$OUTPUT"
+}
+
+l2_bench() {
+    if ((EUID != 0)); then
+        err "must run as root"
+        return 1
+    fi
+
+    build || return 1
+    setup || return 1
+
+    echo "Running ... modes $MODES, sizes $SIZES, $COUNT frames each, mtu $MTU"
+    echo "mode,frame_size,sent,received,lost,loss_pct,pps,gbps,cpu_ns_per_pkt" | tee "$OUTPUT"
+
+    for mode in $MODES; do
+        for size in $SIZES; do
+            run_one $mode $size || return 1
+        done
+    done
+
+    echo "results written to $OUTPUT and $RESULTS"
+}
+
+# main
+l2_bench
@@ -0,0 +1,157 @@
+#ifndef L2_PACKET_H
+#define L2_PACKET_H
+
+#include <endian.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#define L2_STAMP_MAGIC 0x4c325354 /* "L2ST" */
+
+/*
+ * Stamp written by l2_packet_sender at the start of the payload, right
+ * after the Ethernet header, and checked by l2_packet_receiver. All
+ * fields are big endian. Every sender thread is its own stream with its
+ * own sequence space. tx_sec/tx_nsec are CLOCK_REALTIME, so one-way
+ * latency across hosts is only meaningful with synchronized clocks.
+ */
+struct l2_stamp {
+    uint32_t magic;
+    uint16_t stream;
+    uint16_t reserved;
+    uint64_t seq;
+    uint32_t tx_sec;
+    uint32_t tx_nsec;
+} __attribute__((packed));
+
+static inline void l2_stamp_write(void *payload, uint16_t stream, uint64_t seq,
+                                  const struct timespec *ts)
+{
+    struct l2_stamp *stamp = payload;
+
+    stamp->magic = htobe32(L2_STAMP_MAGIC);
+    stamp->stream = htobe16(stream);
+    stamp->reserved = 0;
+    stamp->seq = htobe64(seq);
+    stamp->tx_sec = htobe32((uint32_t)ts->tv_sec);
+    stamp->tx_nsec = htobe32((uint32_t)ts->tv_nsec);
+}
+
+/* Returns 0 and fills the host order fields, -1 if there is no stamp */
+static inline int l2_stamp_read(const void *payload, uint16_t *stream, uint64_t *seq,
+                                struct timespec *ts)
+{
+    const struct l2_stamp *stamp = payload;
+
+    if (be32toh(stamp->magic) != L2_STAMP_MAGIC)
+        return -1;
+
+    *stream = be16toh(stamp->stream);
+    *seq = be64toh(stamp->seq);
+    ts->tv_sec = be32toh(stamp->tx_sec);
+    ts->tv_nsec = be32toh(stamp->tx_nsec);
+
+    return 0;
+}
+
+/*
+ * Result record, one JSON object per line, shared with locktest and
+ * memtest so results of all tools go into one place. The fields are
+ * described in results/compare_results.py. --json - writes to stdout,
+ * anything else is a file the record is appended to.
+ */
+static inline FILE *l2_result_open(const char *path)
+{
+    if (strcmp(path, "-") == 0)
+        return stdout;
+    return fopen(path, "a");
+}
+
+static inline void l2_result_close(FILE *f)
+{
+    if (f == stdout)
+        fflush(f);
+    else
+        fclose(f);
+}
+
+/* String value in quotes, escaped as JSON wants it */
+static inline void l2_result_string(FILE *f, const char *str)
+{
+    const unsigned char *c;
+
+    fputc('"', f);
+    for (c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(f, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(f, "\\u%04x", *c);
+        else
+            fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+/* "tool", "mode", "host" and "time", the record is left open */
+static inline void l2_result_begin(FILE *f, const char *tool, const char *mode)
+{
+    struct utsname uts = {};
+    glob_t nodes = {};
+    int nnodes = 1;
+
+    uname(&uts);
+    if (glob("/sys/devices/system/node/node[0-9]*", 0, NULL, &nodes) == 0)
+        nnodes = nodes.gl_pathc;
+    globfree(&nodes);
+
+    fprintf(f, "{\"tool\": ");
+    l2_result_string(f, tool);
+    fprintf(f, ", \"mode\": ");
+    l2_result_string(f, mode);
+    fprintf(f, ", \"host\": {\"hostname\": ");
+    l2_result_string(f, uts.nodename);
+    fprintf(f, ", \"kernel\": ");
+    l2_result_string(f, uts.release);
+    fprintf(f, ", \"cpus\": %ld, \"nodes\": %d}, \"time\": %lld",
+            sysconf(_SC_NPROCESSORS_ONLN), nnodes, (long long)time(NULL));
+}
+
+/*
+ * Percentile of a histogram of power of two buckets, bucket i counting
+ * values < 2^i, as the upper bound of its bucket but at most max
+ */
+static inline uint64_t l2_hist_percentile(const uint64_t *hist, int buckets, uint64_t count,
+                                          double pct, uint64_t max)
+{
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < buckets; i++) {
+        seen += hist[i];
+        if (seen >= count * pct / 100 && seen > 0)
+            return (1ULL << i) < max ? (1ULL << i) : max;
+    }
+
+    return max;
+}
+
+static inline void l2_result_latency(FILE *f, const uint64_t *hist, int buckets, uint64_t count,
+                                     uint64_t sum, uint64_t min, uint64_t max)
+{
+    if (count == 0)
+        return;
+
+    fprintf(f, ", \"latency_ns\": {\"min\": %llu, \"avg\": %llu, \"p50\": %llu, "
+            "\"p90\": %llu, \"p99\": %llu, \"max\": %llu}",
+            (unsigned long long)min, (unsigned long long)(sum / count),
+            (unsigned long long)l2_hist_percentile(hist, buckets, count, 50, max),
+            (unsigned long long)l2_hist_percentile(hist, buckets, count, 90, max),
+            (unsigned long long)l2_hist_percentile(hist, buckets, count, 99, max),
+            (unsigned long long)max);
+}
+
+#endif /* L2_PACKET_H */
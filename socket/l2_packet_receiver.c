@@ -0,0 +1,480 @@
+/*
+ * Receiver counterpart of l2_packet_sender. Frames of the configured
+ * ether_proto are read through a TPACKET_V3 RX ring and the stamp written
+ * by the sender (see l2_packet.h) is used to account for loss, reordering,
+ * duplicates and one-way latency per sender stream.
+ *
+ * End-to-end test over a local veth pair:
+ *
+ *   ip link add veth0 type veth peer name veth1
+ *   ip link set veth0 up && ip link set veth1 up
+ *   ./l2_packet_receiver -I veth1 &
+ *   ./l2_packet_sender -I veth0 -i 0 -c 100000 -s 64
+ *   kill -INT %1
+ */
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <netinet/ether.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "l2_packet.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define MAX_STREAMS 256
+/* Sequence window used to tell late packets from duplicates */
+#define SEQ_WINDOW 4096
+/* Power of two latency buckets, bucket i counts latency < 2^i ns */
+#define LATENCY_BUCKETS 40
+
+typedef struct {
+    char interface[IFNAMSIZ];
+    uint32_t ether_proto;
+    int count;
+    int duration;
+    int block_size;
+    int block_count;
+    char *json;
+} receiver_params_t;
+
+typedef struct {
+    int active;
+    /* First sequence number received, earlier ones were never counted as lost */
+    uint64_t first_seq;
+    uint64_t next_seq;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t duplicates;
+    uint8_t seen[SEQ_WINDOW / 8];
+} stream_stats_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t unstamped;
+    uint64_t latency_count;
+    uint64_t latency_sum;
+    uint64_t latency_min;
+    uint64_t latency_max;
+    uint64_t latency_hist[LATENCY_BUCKETS];
+    stream_stats_t streams[MAX_STREAMS];
+} receiver_stats_t;
+
+static volatile sig_atomic_t stop_receiving;
+
+static void stop_handler(int signo)
+{
+    (void)signo;
+    stop_receiving = 1;
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void parse_command_line_options(int argc, char **argv, void *params)
+{
+    int val;
+    int option_index = 0;
+    receiver_params_t *receiver_params = params;
+
+    const struct option long_options[] = {
+        {"interface", required_argument, NULL, 'I'},
+        {"ether_proto", required_argument, NULL, 'p'},
+        {"count", required_argument, NULL, 'c'},
+        {"duration", required_argument, NULL, 't'},
+        {"block_size", required_argument, NULL, 'b'},
+        {"block_count", required_argument, NULL, 'n'},
+        {"json", required_argument, NULL, 'j'},
+        {0, 0, 0, 0},
+    };
+
+    while (1) {
+        val = getopt_long(argc, argv, "I:p:c:t:", long_options, &option_index);
+        if (val == -1) {
+            break;
+        }
+
+        switch (val) {
+        case 'I':
+            strncpy(receiver_params->interface, optarg, IFNAMSIZ - 1);
+            printf("option interface with value '%s'\n", receiver_params->interface);
+            break;
+        case 'p':
+            receiver_params->ether_proto = strtoul(optarg, NULL, 0);
+            printf("option ether_proto with value '0x%04x'\n", receiver_params->ether_proto);
+            break;
+        case 'c':
+            receiver_params->count = strtoul(optarg, NULL, 0);
+            printf("option count with value '%d'\n", receiver_params->count);
+            break;
+        case 't':
+            receiver_params->duration = strtoul(optarg, NULL, 0);
+            printf("option duration with value '%d' s\n", receiver_params->duration);
+            break;
+        case 'b':
+            receiver_params->block_size = strtoul(optarg, NULL, 0);
+            printf("option block_size with value '%d'\n", receiver_params->block_size);
+            break;
+        case 'n':
+            receiver_params->block_count = strtoul(optarg, NULL, 0);
+            printf("option block_count with value '%d'\n", receiver_params->block_count);
+            break;
+        case 'j':
+            receiver_params->json = optarg;
+            printf("option json with value '%s'\n", receiver_params->json);
+            break;
+        }
+    }
+}
+
+static inline int seen_test_and_set(stream_stats_t *stream, uint64_t seq)
+{
+    uint8_t bit = 1 << (seq % 8);
+    uint8_t *byte = &stream->seen[(seq % SEQ_WINDOW) / 8];
+    int was_set = *byte & bit;
+
+    *byte |= bit;
+    return was_set;
+}
+
+static inline void seen_clear(stream_stats_t *stream, uint64_t seq)
+{
+    stream->seen[(seq % SEQ_WINDOW) / 8] &= ~(1 << (seq % 8));
+}
+
+/*
+ * Sequence accounting. Packets skipped over are counted as lost; if one of
+ * them shows up later within SEQ_WINDOW it is moved from lost to reordered.
+ * One sent before the first packet received only counts as reordered.
+ * A sequence number already seen within the window is a duplicate.
+ */
+static void account_seq(stream_stats_t *stream, uint64_t seq)
+{
+    if (!stream->active) {
+        /* Receiver may be started after the sender */
+        stream->active = 1;
+        stream->first_seq = seq;
+        stream->next_seq = seq;
+    }
+
+    stream->received++;
+
+    if (seq >= stream->next_seq) {
+        uint64_t gap = seq - stream->next_seq;
+
+        if (gap >= SEQ_WINDOW) {
+            memset(stream->seen, 0, sizeof(stream->seen));
+        } else {
+            uint64_t s;
+            for (s = stream->next_seq; s < seq; s++)
+                seen_clear(stream, s);
+        }
+        seen_clear(stream, seq);
+        seen_test_and_set(stream, seq);
+        stream->lost += gap;
+        stream->next_seq = seq + 1;
+    } else if (stream->next_seq - seq > SEQ_WINDOW) {
+        /* Too old to tell, count it as reordered */
+        stream->reordered++;
+    } else if (seen_test_and_set(stream, seq)) {
+        stream->duplicates++;
+    } else {
+        stream->reordered++;
+        if (seq >= stream->first_seq && stream->lost > 0)
+            stream->lost--;
+    }
+}
+
+static void account_latency(receiver_stats_t *stats, const struct timespec *tx,
+                            const struct timespec *rx)
+{
+    int64_t latency = (int64_t)(rx->tv_sec - tx->tv_sec) * (int64_t)NSEC_PER_SEC +
+                      (rx->tv_nsec - tx->tv_nsec);
+    int bucket = 0;
+
+    /* Clocks out of sync */
+    if (latency < 0)
+        latency = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && (uint64_t)latency >= (1ULL << bucket))
+        bucket++;
+    stats->latency_hist[bucket]++;
+
+    if (stats->latency_count == 0 || (uint64_t)latency < stats->latency_min)
+        stats->latency_min = latency;
+    if ((uint64_t)latency > stats->latency_max)
+        stats->latency_max = latency;
+    stats->latency_sum += latency;
+    stats->latency_count++;
+}
+
+static void process_frame(receiver_stats_t *stats, struct tpacket3_hdr *hdr)
+{
+    const uint8_t *frame = (const uint8_t *)hdr + hdr->tp_mac;
+    const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+        ((const uint8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    struct timespec tx, rx = {
+        .tv_sec = hdr->tp_sec,
+        .tv_nsec = hdr->tp_nsec,
+    };
+    uint16_t stream;
+    uint64_t seq;
+
+    /* Do not account own frames when sender and receiver share a link */
+    if (sll->sll_pkttype == PACKET_OUTGOING)
+        return;
+
+    stats->frames++;
+    stats->bytes += hdr->tp_len;
+
+    /* VLAN tag is usually stripped by the kernel, skip it if not */
+    unsigned int hdr_len = sizeof(struct ether_header);
+    if (hdr->tp_snaplen >= hdr_len + 4 &&
+        ((const struct ether_header *)frame)->ether_type == htons(ETH_P_8021Q))
+        hdr_len += 4;
+
+    if (hdr->tp_snaplen < hdr_len + sizeof(struct l2_stamp) ||
+        l2_stamp_read(frame + hdr_len, &stream, &seq, &tx) < 0) {
+        stats->unstamped++;
+        return;
+    }
+
+    account_seq(&stats->streams[stream % MAX_STREAMS], seq);
+    account_latency(stats, &tx, &rx);
+}
+
+static void print_report(receiver_stats_t *stats, int sockfd, double elapsed)
+{
+    struct tpacket_stats_v3 tp_stats = {};
+    socklen_t len = sizeof(tp_stats);
+    uint64_t received = 0, lost = 0, reordered = 0, duplicates = 0;
+    int i;
+
+    if (getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, &tp_stats, &len) < 0)
+        perror("PACKET_STATISTICS");
+
+    printf("received %llu frames, %llu bytes in %.3f s (%.0f pps), %llu unstamped, %u ring drops\n",
+           (unsigned long long)stats->frames, (unsigned long long)stats->bytes, elapsed,
+           elapsed > 0 ? stats->frames / elapsed : 0,
+           (unsigned long long)stats->unstamped, tp_stats.tp_drops);
+
+    for (i = 0; i < MAX_STREAMS; i++) {
+        stream_stats_t *stream = &stats->streams[i];
+
+        if (!stream->active)
+            continue;
+        printf("stream %d: received %llu, lost %llu, reordered %llu, duplicates %llu, last seq %llu\n",
+               i, (unsigned long long)stream->received, (unsigned long long)stream->lost,
+               (unsigned long long)stream->reordered, (unsigned long long)stream->duplicates,
+               (unsigned long long)stream->next_seq - 1);
+        received += stream->received;
+        lost += stream->lost;
+        reordered += stream->reordered;
+        duplicates += stream->duplicates;
+    }
+    printf("total: received %llu, lost %llu (%.4f%%), reordered %llu, duplicates %llu\n",
+           (unsigned long long)received, (unsigned long long)lost,
+           received + lost ? 100.0 * lost / (received + lost) : 0,
+           (unsigned long long)reordered, (unsigned long long)duplicates);
+
+    if (stats->latency_count == 0)
+        return;
+
+    printf("latency: min %llu ns, avg %llu ns, max %llu ns\n",
+           (unsigned long long)stats->latency_min,
+           (unsigned long long)(stats->latency_sum / stats->latency_count),
+           (unsigned long long)stats->latency_max);
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        if (stats->latency_hist[i] == 0)
+            continue;
+        printf("  < %12llu ns: %llu\n", 1ULL << i, (unsigned long long)stats->latency_hist[i]);
+    }
+}
+
+/* Result record of the run for --json, lost frames count as errors */
+static void write_result(const receiver_params_t *params, const receiver_stats_t *stats,
+                         double elapsed)
+{
+    uint64_t received = 0, lost = 0, reordered = 0, duplicates = 0;
+    FILE *f = l2_result_open(params->json);
+    int i;
+
+    if (f == NULL) {
+        perror(params->json);
+        return;
+    }
+    for (i = 0; i < MAX_STREAMS; i++) {
+        received += stats->streams[i].received;
+        lost += stats->streams[i].lost;
+        reordered += stats->streams[i].reordered;
+        duplicates += stats->streams[i].duplicates;
+    }
+
+    l2_result_begin(f, "l2_packet_receiver", "tpacket_v3");
+    fprintf(f, ", \"params\": {\"interface\": ");
+    l2_result_string(f, params->interface);
+    fprintf(f, ", \"ether_proto\": %u, \"block_size\": %d, \"block_count\": %d}",
+            params->ether_proto, params->block_size, params->block_count);
+    fprintf(f, ", \"duration_ns\": %llu, \"throughput\": %.0f, \"throughput_unit\": \"pps\"",
+            (unsigned long long)(elapsed * NSEC_PER_SEC), elapsed > 0 ? stats->frames / elapsed : 0);
+    l2_result_latency(f, stats->latency_hist, LATENCY_BUCKETS, stats->latency_count,
+                      stats->latency_sum, stats->latency_min, stats->latency_max);
+    fprintf(f, ", \"errors\": %llu, \"metrics\": {\"received\": %llu, \"lost\": %llu, "
+            "\"reordered\": %llu, \"duplicates\": %llu, \"unstamped\": %llu}}\n",
+            (unsigned long long)lost, (unsigned long long)received, (unsigned long long)lost,
+            (unsigned long long)reordered, (unsigned long long)duplicates,
+            (unsigned long long)stats->unstamped);
+    l2_result_close(f);
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+    receiver_params_t receiver_params = {
+        .interface = "eth0",
+        .ether_proto = 0x8951,
+        .count = -1,
+        .duration = 0,
+        .block_size = 1 << 22,
+        .block_count = 64,
+    };
+
+    parse_command_line_options(argc, argv, &receiver_params);
+
+    receiver_stats_t *stats = calloc(1, sizeof(receiver_stats_t));
+    if (stats == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    int sockfd;
+    /* Open RAW socket to receive on */
+    if ((sockfd = socket(AF_PACKET, SOCK_RAW, htons(receiver_params.ether_proto))) == -1) {
+        perror("socket");
+        free(stats);
+        return -1;
+    }
+
+    uint8_t *ring = MAP_FAILED;
+    struct tpacket_req3 req = {};
+
+    int version = TPACKET_V3;
+    if (setsockopt(sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("PACKET_VERSION");
+        ret = -1;
+        goto end;
+    }
+
+    /* Blocks are handed over when full or after retire_blk_tov ms */
+    req.tp_block_size = receiver_params.block_size;
+    req.tp_block_nr = receiver_params.block_count;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+    req.tp_retire_blk_tov = 10;
+    if (setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        perror("PACKET_RX_RING");
+        ret = -1;
+        goto end;
+    }
+
+    ring = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, sockfd, 0);
+    if (ring == MAP_FAILED) {
+        /* MAP_LOCKED may exceed RLIMIT_MEMLOCK */
+        ring = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, sockfd, 0);
+    }
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        ret = -1;
+        goto end;
+    }
+
+    struct ifreq if_idx = {};
+    strncpy(if_idx.ifr_name, receiver_params.interface, IFNAMSIZ - 1);
+    /* Get the index of the interface to receive on */
+    if (ioctl(sockfd, SIOCGIFINDEX, &if_idx) < 0) {
+        perror("SIOCGIFINDEX");
+        ret = -1;
+        goto end;
+    }
+
+    struct sockaddr_ll socket_address = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(receiver_params.ether_proto),
+        .sll_ifindex = if_idx.ifr_ifindex,
+    };
+    if (bind(sockfd, (struct sockaddr *)&socket_address, sizeof(socket_address)) < 0) {
+        perror("bind");
+        ret = -1;
+        goto end;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct pollfd pfd = {
+        .fd = sockfd,
+        .events = POLLIN | POLLERR,
+    };
+    unsigned int block = 0;
+    while (!stop_receiving) {
+        struct tpacket_block_desc *desc = (struct tpacket_block_desc *)
+            (ring + (size_t)block * req.tp_block_size);
+
+        if (!(desc->hdr.bh1.block_status & TP_STATUS_USER)) {
+            poll(&pfd, 1, 100);
+        } else {
+            struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)
+                ((uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt);
+            uint32_t i;
+
+            for (i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+                process_frame(stats, hdr);
+                hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+            }
+
+            /* Hand the block back to the kernel */
+            __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            block = (block + 1) % req.tp_block_nr;
+        }
+
+        if (receiver_params.count > 0 && stats->frames >= (uint64_t)receiver_params.count)
+            break;
+        if (receiver_params.duration > 0 && elapsed_since(&start) >= receiver_params.duration)
+            break;
+    }
+
+    double elapsed = elapsed_since(&start);
+    print_report(stats, sockfd, elapsed);
+    if (receiver_params.json)
+        write_result(&receiver_params, stats, elapsed);
+
+end:
+    if (ring != MAP_FAILED)
+        munmap(ring, (size_t)req.tp_block_size * req.tp_block_nr);
+    close(sockfd);
+    free(stats);
+    return ret;
+}
@@ -1,119 +1,2156 @@
+/*
+ * Raw Ethernet frame generator. Built as a program:
+ *
+ *   gcc -O2 -pthread -o l2_packet_sender l2_packet_sender.c
+ *
+ * or as a shared library for l2_packet_sender.py and other ctypes users,
+ * exporting l2_sender_main(), which runs the whole send loop in C:
+ *
+ *   gcc -O2 -pthread -shared -fPIC -fvisibility=hidden -DL2_SENDER_LIBRARY \
+ *       -o libl2sender.so l2_packet_sender.c
+ */
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <errno.h>
 #include <getopt.h>
+#include <linux/errqueue.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <poll.h>
 #include <net/if.h>
 #include <netinet/ether.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "l2_packet.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define MAX_ERRNO 256
+/* Retry backoff on transient send errors such as ENOBUFS */
+#define MIN_BACKOFF_NS (1 * NSEC_PER_USEC)
+#define MAX_BACKOFF_NS (1 * NSEC_PER_MSEC)
+#define VLAN_HLEN 4
+#define MAX_SIZES 4096
+/* Simple IMIX 7:4:1 of 64/594/1518 byte frames, as sent without FCS */
+#define DEFAULT_IMIX "60:7,590:4,1514:1"
+#define LINKTYPE_ETHERNET 1
+#define PCAPNG_MAX_INTERFACES 64
+/* AF_XDP umem and ring sizes, all powers of two */
+#define XSK_FRAME_SIZE 4096
+#define XSK_NUM_FRAMES 4096
+#define XSK_TX_RING_SIZE 2048
+#define XSK_COMP_RING_SIZE 4096
+#define XSK_FILL_RING_SIZE 64
+
+/* Power of two latency buckets, bucket i counts latency < 2^i ns */
+#define LATENCY_BUCKETS 40
+/* Send times kept to match TX timestamps against, a power of two */
+#define TX_STAMP_RING 65536
+/* Error queue messages read per recvmmsg() */
+#define TX_STAMP_BATCH 64
+/* Frames sent between two error queue drains */
+#define TX_STAMP_DRAIN 16
+/* Quiet time that ends the final drain */
+#define TX_STAMP_LINGER_MS 100
+
+#ifdef L2_SENDER_LIBRARY
+#define L2_SENDER_API __attribute__((visibility("default")))
+#else
+#define L2_SENDER_API
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+enum {
+    ENGINE_PACKET,
+    ENGINE_XDP,
+    ENGINE_URING,
+};
+
+enum {
+    TX_STAMP_OFF,
+    TX_STAMP_SOFTWARE,
+    TX_STAMP_HARDWARE,
+};
+
+/* Send path stages measured with --tx_timestamp */
+enum {
+    TX_STAGE_SCHED,
+    TX_STAGE_QUEUE,
+    TX_STAGE_SOFTWARE,
+    TX_STAGE_HARDWARE,
+    TX_STAGES,
+};
+
+static const char *const tx_stage_names[TX_STAGES] = {
+    [TX_STAGE_SCHED] = "send to qdisc",
+    [TX_STAGE_QUEUE] = "qdisc to driver",
+    [TX_STAGE_SOFTWARE] = "send to driver",
+    [TX_STAGE_HARDWARE] = "send to wire",
+};
+
 typedef struct {
     char interface[IFNAMSIZ];
     int interval;
     int packetsize;
     int count;
+    int batch;
+    double pps;
+    double rate;
+    int busy_poll;
+    int threads;
+    char *cpus;
+    int stats_interval;
+    char *sweep;
+    char *imix;
+    int mac_count;
+    int vlan;
+    int vlan_count;
+    char *pcap;
+    double speed;
+    int pcap_loops;
+    int engine;
+    int xdp_queue;
+    int xdp_mode;
+    int uring_depth;
+    int uring_sqpoll;
+    int uring_zc;
+    int tx_timestamp;
+    char *json;
     uint32_t ether_mac[ETH_ALEN];
     uint32_t ether_proto;
     char *data;
 } sender_params_t;
 
-static void parse_command_line_options(int argc, char **argv, void *params)
+/* Frame in a mapped capture file, ts is relative to the first frame */
+typedef struct {
+    uint64_t offset;
+    uint64_t ts;
+    uint32_t len;
+} pcap_packet_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t size;
+    pcap_packet_t *packets;
+    uint64_t count;
+    /* Time of one pass through the file, including one average gap */
+    uint64_t duration;
+    double avg_len;
+    uint32_t max_len;
+} pcap_file_t;
+
+/*
+ * Counters are written by the sending thread and sampled by the main
+ * thread with relaxed atomics for the live report.
+ */
+typedef struct {
+    uint64_t sent;
+    uint64_t bytes;
+    /* Time deliberately slept for --interval or pacing */
+    uint64_t idle_ns;
+    uint64_t errors[MAX_ERRNO];
+} sender_stats_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t hist[LATENCY_BUCKETS];
+} tx_latency_t;
+
+/* CLOCK_REALTIME times of one frame, indexed by its timestamp id */
+typedef struct {
+    uint64_t sent;
+    uint64_t sched;
+    /* Stands for the frame a short send call may have had dropped */
+    int dropped;
+} tx_stamp_slot_t;
+
+typedef struct {
+    const sender_params_t *params;
+    pthread_t tid;
+    int id;
+    int cpu;
+    /* Share of --count and --pps/--rate handled by this thread */
+    int count;
+    double pps;
+    const char *frame;
+    int tx_len;
+    int hdr_len;
+    /* Frame sizes cycled through per packet */
+    const uint16_t *sizes;
+    int nsizes;
+    /* Frames are sent straight from the mapped capture in --pcap mode */
+    const pcap_file_t *pcap;
+    struct sockaddr_ll socket_address;
+    /* Per-thread counters, merged into the live and final report */
+    sender_stats_t stats;
+    /* --tx_timestamp: frames by timestamp id and latency per stage */
+    tx_stamp_slot_t *tx_slots;
+    uint32_t tx_next_id;
+    uint32_t tx_drained_id;
+    /* OPT_ID key of the kernel minus tx_next_id, see tx_stamp_resync() */
+    uint32_t tx_id_skew;
+    uint64_t tx_unmatched;
+    tx_latency_t tx_latency[TX_STAGES];
+    uint64_t start;
+    uint64_t end;
+    uint64_t cpu_ns;
+    int running;
+    int ret;
+} sender_thread_t;
+
+static volatile sig_atomic_t stop_sending;
+
+static void stop_handler(int signo)
+{
+    (void)signo;
+    stop_sending = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = ns / NSEC_PER_SEC,
+        .tv_nsec = ns % NSEC_PER_SEC,
+    };
+
+    nanosleep(&ts, NULL);
+}
+
+/* Queue full: sleep twice as long as last time, up to MAX_BACKOFF_NS */
+static void backoff(uint64_t *backoff_ns)
+{
+    *backoff_ns = *backoff_ns ? *backoff_ns * 2 : MIN_BACKOFF_NS;
+    if (*backoff_ns > MAX_BACKOFF_NS)
+        *backoff_ns = MAX_BACKOFF_NS;
+    sleep_ns(*backoff_ns);
+}
+
+#define STATS_ADD(field, val) __atomic_add_fetch(&(field), (val), __ATOMIC_RELAXED)
+#define STATS_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+/* Parse a number with an optional k/M/G suffix, e.g. "1.5M" */
+static double parse_scaled(const char *str)
+{
+    char *end;
+    double val = strtod(str, &end);
+
+    switch (*end) {
+    case 'k':
+    case 'K':
+        val *= 1e3;
+        break;
+    case 'm':
+    case 'M':
+        val *= 1e6;
+        break;
+    case 'g':
+    case 'G':
+        val *= 1e9;
+        break;
+    }
+
+    return val;
+}
+
+/*
+ * Sleep until the absolute deadline, spinning for the last busy_poll_ns.
+ * Time waited is added to idle_ns, returns the current time.
+ */
+static uint64_t wait_until(uint64_t deadline, uint64_t busy_poll_ns, uint64_t *idle_ns)
+{
+    uint64_t now = now_ns();
+
+    if (now < deadline) {
+        *idle_ns += deadline - now;
+        if (deadline - now > busy_poll_ns) {
+            uint64_t wakeup = deadline - busy_poll_ns;
+            struct timespec ts = {
+                .tv_sec = wakeup / NSEC_PER_SEC,
+                .tv_nsec = wakeup % NSEC_PER_SEC,
+            };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        while ((now = now_ns()) < deadline)
+            ;
+    }
+
+    return now;
+}
+
+/*
+ * Wait until the next packet is due and return how many packets are due
+ * by now (at least one). Deadlines are absolute, derived from the start
+ * time and the number of packets already sent, so sleep overshoot does
+ * not accumulate: when behind schedule the caller sends a burst to catch
+ * up. Gaps shorter than busy_poll_ns are spun instead of slept.
+ */
+static uint64_t pace_wait(uint64_t start, uint64_t sent, double pps, uint64_t busy_poll_ns,
+                          uint64_t *idle_ns)
+{
+    uint64_t deadline = start + (uint64_t)(sent * (NSEC_PER_SEC / pps));
+    uint64_t now = wait_until(deadline, busy_poll_ns, idle_ns);
+
+    uint64_t due = (uint64_t)((now - start) * pps / NSEC_PER_SEC) + 1;
+    return due > sent ? due - sent : 1;
+}
+
+static uint16_t pcap16(const uint8_t *p, int swap)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t pcap32(const uint8_t *p, int swap)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static int pcap_add(pcap_file_t *pcap, uint64_t *alloc, uint64_t offset, uint32_t len, uint64_t ts)
+{
+    if (pcap->count == *alloc) {
+        pcap_packet_t *packets;
+
+        *alloc = *alloc ? *alloc * 2 : 4096;
+        packets = realloc(pcap->packets, *alloc * sizeof(pcap_packet_t));
+        if (packets == NULL)
+            return -1;
+        pcap->packets = packets;
+    }
+    pcap->packets[pcap->count].offset = offset;
+    pcap->packets[pcap->count].len = len;
+    pcap->packets[pcap->count].ts = ts;
+    pcap->count++;
+
+    return 0;
+}
+
+/* Index a classic pcap file, microsecond or nanosecond resolution */
+static int pcap_parse_classic(pcap_file_t *pcap, int swap, uint64_t ns_per_tick)
+{
+    const uint8_t *p = pcap->map;
+    uint64_t alloc = 0, off = 24;
+
+    if (pcap->size < 24 || pcap32(p + 20, swap) != LINKTYPE_ETHERNET) {
+        fprintf(stderr, "pcap: not an Ethernet capture\n");
+        return -1;
+    }
+
+    while (off + 16 <= pcap->size) {
+        uint64_t ts = pcap32(p + off, swap) * NSEC_PER_SEC + pcap32(p + off + 4, swap) * ns_per_tick;
+        uint32_t caplen = pcap32(p + off + 8, swap);
+
+        if (off + 16 + caplen > pcap->size)
+            break;
+        if (pcap_add(pcap, &alloc, off + 16, caplen, ts) < 0)
+            return -1;
+        off += 16 + caplen;
+    }
+
+    return 0;
+}
+
+/* Index a pcapng file: enhanced and simple packet blocks on Ethernet interfaces */
+static int pcap_parse_ng(pcap_file_t *pcap)
+{
+    const uint8_t *p = pcap->map;
+    uint64_t alloc = 0, off = 0, last_ts = 0;
+    int swap = 0, interfaces = 0;
+    uint16_t linktype[PCAPNG_MAX_INTERFACES];
+    double ns_per_tick[PCAPNG_MAX_INTERFACES];
+
+    while (off + 12 <= pcap->size) {
+        uint32_t type = pcap32(p + off, swap);
+        uint32_t block_len;
+
+        if (type == 0x0a0d0d0a) {
+            /* Section header, byte order magic decides endianness */
+            if (off + 12 > pcap->size)
+                break;
+            swap = pcap32(p + off + 8, 0) != 0x1a2b3c4d;
+            interfaces = 0;
+        }
+        block_len = pcap32(p + off + 4, swap);
+        if (block_len < 12 || off + block_len > pcap->size)
+            break;
+
+        if (type == 1 && interfaces < PCAPNG_MAX_INTERFACES) {
+            /* Interface description, look for if_tsresol */
+            uint64_t opt = off + 16;
+
+            linktype[interfaces] = pcap16(p + off + 8, swap);
+            ns_per_tick[interfaces] = 1e3;
+            while (opt + 4 <= off + block_len - 4) {
+                uint16_t code = pcap16(p + opt, swap);
+                uint16_t len = pcap16(p + opt + 2, swap);
+
+                if (code == 0)
+                    break;
+                if (code == 9 && len >= 1) {
+                    /* Power of 10, or of 2 if the top bit is set */
+                    uint8_t resol = p[opt + 4];
+                    double tick = NSEC_PER_SEC;
+                    int k;
+
+                    for (k = 0; k < (resol & 0x7f); k++)
+                        tick /= resol & 0x80 ? 2 : 10;
+                    ns_per_tick[interfaces] = tick;
+                }
+                opt += 4 + ((len + 3) & ~3);
+            }
+            interfaces++;
+        } else if (type == 6 && block_len >= 32) {
+            /* Enhanced packet */
+            uint32_t ifid = pcap32(p + off + 8, swap);
+            uint64_t ticks = (uint64_t)pcap32(p + off + 12, swap) << 32 | pcap32(p + off + 16, swap);
+            uint32_t caplen = pcap32(p + off + 20, swap);
+
+            if (ifid < (uint32_t)interfaces && linktype[ifid] == LINKTYPE_ETHERNET &&
+                caplen <= block_len - 32) {
+                last_ts = (uint64_t)(ticks * ns_per_tick[ifid]);
+                if (pcap_add(pcap, &alloc, off + 28, caplen, last_ts) < 0)
+                    return -1;
+            }
+        } else if (type == 3 && block_len >= 16) {
+            /* Simple packet, no timestamp: keep the previous one */
+            uint32_t caplen = pcap32(p + off + 8, swap);
+
+            if (caplen > block_len - 16)
+                caplen = block_len - 16;
+            if (interfaces > 0 && linktype[0] == LINKTYPE_ETHERNET &&
+                pcap_add(pcap, &alloc, off + 12, caplen, last_ts) < 0)
+                return -1;
+        }
+
+        off += block_len;
+    }
+
+    return 0;
+}
+
+/*
+ * Map a pcap or pcapng capture and index its frames. Frames are not
+ * copied, they are sent straight from the mapping.
+ */
+static int pcap_load(const char *path, pcap_file_t *pcap)
+{
+    struct stat st;
+    uint32_t magic;
+    int fd, ret;
+    uint64_t i, first;
+
+    memset(pcap, 0, sizeof(*pcap));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    pcap->size = st.st_size;
+    pcap->map = pcap->size >= 24 ? mmap(NULL, pcap->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (pcap->map == MAP_FAILED) {
+        fprintf(stderr, "pcap: cannot map '%s'\n", path);
+        pcap->map = NULL;
+        return -1;
+    }
+    madvise((void *)pcap->map, pcap->size, MADV_WILLNEED);
+
+    memcpy(&magic, pcap->map, sizeof(magic));
+    switch (magic) {
+    case 0xa1b2c3d4:
+    case 0xd4c3b2a1:
+        ret = pcap_parse_classic(pcap, magic == 0xd4c3b2a1, NSEC_PER_USEC);
+        break;
+    case 0xa1b23c4d:
+    case 0x4d3cb2a1:
+        ret = pcap_parse_classic(pcap, magic == 0x4d3cb2a1, 1);
+        break;
+    case 0x0a0d0d0a:
+        ret = pcap_parse_ng(pcap);
+        break;
+    default:
+        fprintf(stderr, "pcap: unknown file format\n");
+        ret = -1;
+    }
+    if (ret == 0 && pcap->count == 0) {
+        fprintf(stderr, "pcap: no Ethernet frames in '%s'\n", path);
+        ret = -1;
+    }
+    if (ret < 0)
+        return ret;
+
+    /* Timestamps relative to the first frame, never going backwards */
+    first = pcap->packets[0].ts;
+    for (i = 0; i < pcap->count; i++) {
+        uint64_t ts = pcap->packets[i].ts;
+
+        pcap->packets[i].ts = ts > first ? ts - first : 0;
+        if (i > 0 && pcap->packets[i].ts < pcap->packets[i - 1].ts)
+            pcap->packets[i].ts = pcap->packets[i - 1].ts;
+        pcap->avg_len += (double)pcap->packets[i].len / pcap->count;
+        if (pcap->packets[i].len > pcap->max_len)
+            pcap->max_len = pcap->packets[i].len;
+    }
+    pcap->duration = pcap->packets[pcap->count - 1].ts;
+    if (pcap->count > 1)
+        pcap->duration += pcap->duration / (pcap->count - 1);
+
+    return 0;
+}
+
+static void pcap_unload(pcap_file_t *pcap)
+{
+    if (pcap->map)
+        munmap((void *)pcap->map, pcap->size);
+    free(pcap->packets);
+}
+
+/*
+ * Point the batch at the next frames of the mapped capture. Thread k of N
+ * sends frames k, k+N, ... With --speed the first frame is waited for at
+ * its capture time scaled by speed, the batch then takes the frames that
+ * are due by now. Returns the number of frames in the batch.
+ */
+static int pcap_fill(const sender_thread_t *thread, struct iovec *iovs, int n, uint64_t sent,
+                     uint64_t start, uint64_t busy_poll_ns, uint64_t *idle_ns)
+{
+    const sender_params_t *sender_params = thread->params;
+    const pcap_file_t *pcap = thread->pcap;
+    int timed = sender_params->speed > 0 && thread->pps <= 0;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        uint64_t idx = (sent + j) * sender_params->threads + thread->id;
+        const pcap_packet_t *pkt = &pcap->packets[idx % pcap->count];
+
+        if (timed) {
+            uint64_t deadline = start + (uint64_t)(((idx / pcap->count) * pcap->duration + pkt->ts) /
+                                                   sender_params->speed);
+            if (j == 0)
+                wait_until(deadline, busy_poll_ns, idle_ns);
+            else if (deadline > now_ns())
+                break;
+        }
+        iovs[j].iov_base = (void *)(pcap->map + pkt->offset);
+        iovs[j].iov_len = pkt->len;
+    }
+
+    return j;
+}
+
+/*
+ * Fill sizes[] from "MIN:MAX[:STEP]", returns number of sizes or -1
+ */
+static int parse_sweep(const char *str, uint16_t *sizes, int max)
+{
+    int min_size, max_size, step = 1, n = 0;
+
+    if (sscanf(str, "%d:%d:%d", &min_size, &max_size, &step) < 2 ||
+        min_size <= 0 || max_size < min_size || max_size > UINT16_MAX || step <= 0)
+        return -1;
+
+    for (; min_size <= max_size && n < max; min_size += step)
+        sizes[n++] = min_size;
+
+    return n;
+}
+
+/*
+ * Fill sizes[] from "SIZE:WEIGHT,SIZE:WEIGHT,...". Entries are interleaved
+ * round robin by weight, so 60:2,1514:1 gives 60,1514,60 rather than a run
+ * of each size. Returns number of sizes or -1.
+ */
+static int parse_imix(const char *str, uint16_t *sizes, int max)
+{
+    int size[16], weight[16];
+    int entries = 0, round, i, n = 0, more = 1;
+
+    while (*str && entries < 16) {
+        int len;
+
+        if (sscanf(str, "%d:%d%n", &size[entries], &weight[entries], &len) != 2 ||
+            size[entries] <= 0 || size[entries] > UINT16_MAX || weight[entries] <= 0)
+            return -1;
+        entries++;
+        str += len;
+        if (*str == ',')
+            str++;
+        else if (*str)
+            return -1;
+    }
+
+    for (round = 0; more && n < max; round++) {
+        more = 0;
+        for (i = 0; i < entries && n < max; i++) {
+            if (weight[i] > round) {
+                sizes[n++] = size[i];
+                more = 1;
+            }
+        }
+    }
+
+    return entries ? n : -1;
+}
+
+/*
+ * Patch the per-packet fields of a pre-built frame in place: size,
+ * rotating destination MAC and VLAN id, and the sequence stamp. Returns
+ * the frame length.
+ */
+static inline int patch_frame(const sender_thread_t *thread, char *buf, uint64_t seq,
+                              const struct timespec *ts)
+{
+    const sender_params_t *sender_params = thread->params;
+    int len = thread->sizes[seq % thread->nsizes];
+    uint64_t flow = seq;
+
+    if (sender_params->mac_count > 1) {
+        /* Flows differ in the low 16 bits of the destination MAC */
+        uint16_t mac = ((uint8_t)thread->frame[4] << 8 | (uint8_t)thread->frame[5]) +
+                       flow % sender_params->mac_count;
+        buf[4] = mac >> 8;
+        buf[5] = mac & 0xff;
+        flow /= sender_params->mac_count;
+    }
+    if (sender_params->vlan_count > 1) {
+        uint16_t vid = (sender_params->vlan + flow % sender_params->vlan_count) & 0xfff;
+        buf[ETH_ALEN * 2 + 2] = vid >> 8;
+        buf[ETH_ALEN * 2 + 3] = vid & 0xff;
+    }
+    if (len >= thread->hdr_len + (int)sizeof(struct l2_stamp))
+        l2_stamp_write(buf + thread->hdr_len, thread->id, seq, ts);
+
+    return len;
+}
+
+/*
+ * Parse a cpu list such as "0,2,4-7" into cpus[], returns number of
+ * entries or -1 on a malformed list
+ */
+static int parse_cpu_list(const char *str, int *cpus, int max)
+{
+    int n = 0;
+
+    while (*str) {
+        char *end;
+        int first = strtol(str, &end, 10), last = first;
+
+        if (end == str)
+            return -1;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first)
+                return -1;
+        }
+        for (; first <= last && n < max; first++)
+            cpus[n++] = first;
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return -1;
+        str = end;
+    }
+
+    return n;
+}
+
+static void parse_command_line_options(int argc, char **argv, void *params)
+{
+    int val;
+    int option_index = 0;
+    sender_params_t *sender_params = params;
+
+    const struct option long_options[] = {
+        {"interface", required_argument, NULL, 'I'},
+        {"interval", required_argument, NULL, 'i'},
+        {"count", required_argument, NULL, 'c'},
+        {"packetsize", required_argument, NULL, 's'},
+        {"dst_mac", required_argument, NULL, 'm'},
+        {"ether_proto", required_argument, NULL, 'p'},
+        {"data", required_argument, NULL, 'd'},
+        {"batch", required_argument, NULL, 'b'},
+        {"pps", required_argument, NULL, 'P'},
+        {"rate", required_argument, NULL, 'r'},
+        {"busy-poll", required_argument, NULL, 'B'},
+        {"threads", required_argument, NULL, 'T'},
+        {"cpus", required_argument, NULL, 'C'},
+        {"stats_interval", required_argument, NULL, 'S'},
+        {"sweep", required_argument, NULL, 'w'},
+        {"imix", optional_argument, NULL, 'x'},
+        {"mac_count", required_argument, NULL, 'M'},
+        {"vlan", required_argument, NULL, 'v'},
+        {"vlan_count", required_argument, NULL, 'V'},
+        {"pcap", required_argument, NULL, 'f'},
+        {"speed", required_argument, NULL, 'X'},
+        {"pcap_loops", required_argument, NULL, 'L'},
+        {"engine", required_argument, NULL, 'e'},
+        {"xdp_queue", required_argument, NULL, 'q'},
+        {"xdp_mode", required_argument, NULL, 'Z'},
+        {"uring_depth", required_argument, NULL, 'D'},
+        {"uring_sqpoll", no_argument, NULL, 'Q'},
+        {"uring_zc", no_argument, NULL, 'z'},
+        {"tx_timestamp", optional_argument, NULL, 't'},
+        {"json", required_argument, NULL, 'j'},
+        {0, 0, 0, 0},
+    };
+
+    while (1) {
+        val = getopt_long(argc, argv, "I:i:c:s:", long_options, &option_index);
+        if (val == -1) {
+            break;
+        }
+
+        switch (val) {
+        case 0:
+            printf("option %s", long_options[option_index].name);
+            if (optarg)
+                printf(" with arg %s", optarg);
+            printf("\n");
+            break;
+        case 'I':
+            strncpy(sender_params->interface, optarg, IFNAMSIZ - 1);
+            printf("option interface with value '%s'\n", sender_params->interface);
+            break;
+        case 'i':
+            sender_params->interval = strtoul(optarg, NULL, 0);
+            printf("option interval with value '%d'\n", sender_params->interval);
+            break;
+        case 'c':
+            sender_params->count = strtoul(optarg, NULL, 0);
+            printf("option count with value '%d'\n", sender_params->count);
+            break;
+        case 's':
+            sender_params->packetsize = strtoul(optarg, NULL, 0);
+            printf("option packetsize with value '%d'\n", sender_params->packetsize);
+            break;
+        case 'm':
+            sscanf(optarg, "%02x:%02x:%02x:%02x:%02x:%02x",
+                   &sender_params->ether_mac[0],
+                   &sender_params->ether_mac[1],
+                   &sender_params->ether_mac[2],
+                   &sender_params->ether_mac[3],
+                   &sender_params->ether_mac[4],
+                   &sender_params->ether_mac[5]);
+            printf("option dst_mac with value '%s'\n", optarg);
+            break;
+        case 'p':
+            sender_params->ether_proto = strtoul(optarg, NULL, 0);
+            printf("option ether_proto with value '0x%04x'\n", sender_params->ether_proto);
+            break;
+        case 'd':
+            sender_params->data = (void *)optarg;
+            printf("option data with value '%s'\n", sender_params->data);
+            break;
+        case 'b':
+            sender_params->batch = strtoul(optarg, NULL, 0);
+            if (sender_params->batch < 1)
+                sender_params->batch = 1;
+            printf("option batch with value '%d'\n", sender_params->batch);
+            break;
+        case 'P':
+            sender_params->pps = parse_scaled(optarg);
+            printf("option pps with value '%.0f'\n", sender_params->pps);
+            break;
+        case 'r':
+            sender_params->rate = parse_scaled(optarg);
+            printf("option rate with value '%.0f' bit/s\n", sender_params->rate);
+            break;
+        case 'B':
+            sender_params->busy_poll = strtoul(optarg, NULL, 0);
+            printf("option busy-poll with value '%d' us\n", sender_params->busy_poll);
+            break;
+        case 'T':
+            sender_params->threads = strtoul(optarg, NULL, 0);
+            if (sender_params->threads < 1)
+                sender_params->threads = 1;
+            printf("option threads with value '%d'\n", sender_params->threads);
+            break;
+        case 'C':
+            sender_params->cpus = optarg;
+            printf("option cpus with value '%s'\n", sender_params->cpus);
+            break;
+        case 'S':
+            sender_params->stats_interval = strtoul(optarg, NULL, 0);
+            printf("option stats_interval with value '%d' s\n", sender_params->stats_interval);
+            break;
+        case 'w':
+            sender_params->sweep = optarg;
+            printf("option sweep with value '%s'\n", sender_params->sweep);
+            break;
+        case 'x':
+            sender_params->imix = optarg ? optarg : DEFAULT_IMIX;
+            printf("option imix with value '%s'\n", sender_params->imix);
+            break;
+        case 'M':
+            sender_params->mac_count = strtoul(optarg, NULL, 0);
+            printf("option mac_count with value '%d'\n", sender_params->mac_count);
+            break;
+        case 'v':
+            sender_params->vlan = strtoul(optarg, NULL, 0);
+            if (sender_params->vlan_count == 0)
+                sender_params->vlan_count = 1;
+            printf("option vlan with value '%d'\n", sender_params->vlan);
+            break;
+        case 'V':
+            sender_params->vlan_count = strtoul(optarg, NULL, 0);
+            printf("option vlan_count with value '%d'\n", sender_params->vlan_count);
+            break;
+        case 'f':
+            sender_params->pcap = optarg;
+            printf("option pcap with value '%s'\n", sender_params->pcap);
+            break;
+        case 'X':
+            sender_params->speed = strtod(optarg, NULL);
+            printf("option speed with value '%g'\n", sender_params->speed);
+            break;
+        case 'L':
+            sender_params->pcap_loops = strtoul(optarg, NULL, 0);
+            printf("option pcap_loops with value '%d'\n", sender_params->pcap_loops);
+            break;
+        case 'e':
+            if (strcmp(optarg, "xdp") == 0)
+                sender_params->engine = ENGINE_XDP;
+            else if (strcmp(optarg, "uring") == 0)
+                sender_params->engine = ENGINE_URING;
+            else
+                sender_params->engine = ENGINE_PACKET;
+            printf("option engine with value '%s'\n", optarg);
+            break;
+        case 'q':
+            sender_params->xdp_queue = strtoul(optarg, NULL, 0);
+            printf("option xdp_queue with value '%d'\n", sender_params->xdp_queue);
+            break;
+        case 'Z':
+            if (strcmp(optarg, "copy") == 0)
+                sender_params->xdp_mode = XDP_COPY;
+            else if (strcmp(optarg, "zerocopy") == 0)
+                sender_params->xdp_mode = XDP_ZEROCOPY;
+            else
+                sender_params->xdp_mode = 0;
+            printf("option xdp_mode with value '%s'\n", optarg);
+            break;
+        case 'D':
+            sender_params->uring_depth = strtoul(optarg, NULL, 0);
+            if (sender_params->uring_depth < 1)
+                sender_params->uring_depth = 1;
+            printf("option uring_depth with value '%d'\n", sender_params->uring_depth);
+            break;
+        case 'Q':
+            sender_params->uring_sqpoll = 1;
+            printf("option uring_sqpoll\n");
+            break;
+        case 'z':
+            sender_params->uring_zc = 1;
+            printf("option uring_zc\n");
+            break;
+        case 't':
+            if (optarg && strcmp(optarg, "hw") == 0)
+                sender_params->tx_timestamp = TX_STAMP_HARDWARE;
+            else
+                sender_params->tx_timestamp = TX_STAMP_SOFTWARE;
+            printf("option tx_timestamp with value '%s'\n", optarg ? optarg : "sw");
+            break;
+        case 'j':
+            sender_params->json = optarg;
+            printf("option json with value '%s'\n", sender_params->json);
+            break;
+        }
+    }
+}
+
+typedef struct {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t size;
+    void *map;
+    size_t map_len;
+} xsk_ring_t;
+
+/*
+ * AF_XDP socket of one thread. Every umem frame is pre-populated with the
+ * template, so sending only patches per-packet fields in place and posts
+ * a descriptor; frames come back through the completion ring.
+ */
+typedef struct {
+    int fd;
+    uint8_t *umem;
+    size_t umem_len;
+    xsk_ring_t tx;
+    xsk_ring_t comp;
+    xsk_ring_t fill;
+    uint64_t *free_frames;
+    uint32_t nfree;
+    /* umem address of each frame of the current batch */
+    uint64_t *batch;
+    int need_wakeup;
+} xsk_t;
+
+static int xsk_map_ring(xsk_t *xsk, xsk_ring_t *ring, const struct xdp_ring_offset *off,
+                        uint32_t size, size_t desc_size, off_t pgoff)
+{
+    ring->size = size;
+    ring->map_len = off->desc + size * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, xsk->fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        return -1;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->flags = (uint32_t *)((uint8_t *)ring->map + off->flags);
+    ring->descs = (uint8_t *)ring->map + off->desc;
+
+    return 0;
+}
+
+static void xsk_close(xsk_t *xsk)
+{
+    if (xsk->tx.map)
+        munmap(xsk->tx.map, xsk->tx.map_len);
+    if (xsk->comp.map)
+        munmap(xsk->comp.map, xsk->comp.map_len);
+    if (xsk->fill.map)
+        munmap(xsk->fill.map, xsk->fill.map_len);
+    if (xsk->fd >= 0)
+        close(xsk->fd);
+    if (xsk->umem)
+        munmap(xsk->umem, xsk->umem_len);
+    free(xsk->free_frames);
+    free(xsk->batch);
+    xsk->fd = -1;
+}
+
+/*
+ * Open an AF_XDP socket on queue xdp_queue + thread id. TX only needs no
+ * XDP program. Binding is tried in the requested mode with need_wakeup,
+ * then falls back to copy mode, which works on veth and any other netdev.
+ */
+static int xsk_open(const sender_thread_t *thread, xsk_t *xsk, int ifindex)
+{
+    const sender_params_t *sender_params = thread->params;
+    struct xdp_umem_reg umem_reg = {};
+    struct xdp_mmap_offsets off = {};
+    socklen_t optlen = sizeof(off);
+    uint32_t i, size;
+
+    memset(xsk, 0, sizeof(*xsk));
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd < 0) {
+        perror("socket(AF_XDP)");
+        return -1;
+    }
+
+    xsk->umem_len = (size_t)XSK_FRAME_SIZE * XSK_NUM_FRAMES;
+    xsk->umem = mmap(NULL, xsk->umem_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    xsk->free_frames = calloc(XSK_NUM_FRAMES, sizeof(uint64_t));
+    xsk->batch = calloc(sender_params->batch, sizeof(uint64_t));
+    if (xsk->umem == MAP_FAILED || xsk->free_frames == NULL || xsk->batch == NULL) {
+        if (xsk->umem == MAP_FAILED)
+            xsk->umem = NULL;
+        perror("umem");
+        goto err;
+    }
+    for (i = 0; i < XSK_NUM_FRAMES; i++) {
+        memcpy(xsk->umem + (size_t)i * XSK_FRAME_SIZE, thread->frame, thread->tx_len);
+        xsk->free_frames[xsk->nfree++] = (uint64_t)i * XSK_FRAME_SIZE;
+    }
+
+    umem_reg.addr = (uintptr_t)xsk->umem;
+    umem_reg.len = xsk->umem_len;
+    umem_reg.chunk_size = XSK_FRAME_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) < 0) {
+        perror("XDP_UMEM_REG (check RLIMIT_MEMLOCK)");
+        goto err;
+    }
+
+    /* Fill ring is unused for TX, but a umem cannot be bound without one */
+    size = XSK_FILL_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0)
+        goto err_opt;
+    size = XSK_COMP_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0)
+        goto err_opt;
+    size = XSK_TX_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0)
+        goto err_opt;
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+        goto err_opt;
+
+    if (xsk_map_ring(xsk, &xsk->tx, &off.tx, XSK_TX_RING_SIZE,
+                     sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0 ||
+        xsk_map_ring(xsk, &xsk->comp, &off.cr, XSK_COMP_RING_SIZE,
+                     sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+        xsk_map_ring(xsk, &xsk->fill, &off.fr, XSK_FILL_RING_SIZE,
+                     sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0) {
+        perror("mmap(AF_XDP ring)");
+        goto err;
+    }
+
+    const uint16_t modes[] = {
+        sender_params->xdp_mode | XDP_USE_NEED_WAKEUP,
+        XDP_COPY | XDP_USE_NEED_WAKEUP,
+        XDP_COPY,
+    };
+    struct sockaddr_xdp sxdp = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = sender_params->xdp_queue + thread->id,
+    };
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        sxdp.sxdp_flags = modes[i];
+        if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0)
+            break;
+    }
+    if (i == sizeof(modes) / sizeof(modes[0])) {
+        perror("bind(AF_XDP)");
+        goto err;
+    }
+    if (i > 0)
+        fprintf(stderr, "thread %d: AF_XDP fell back to copy mode on queue %d\n",
+                thread->id, sxdp.sxdp_queue_id);
+    xsk->need_wakeup = sxdp.sxdp_flags & XDP_USE_NEED_WAKEUP;
+
+    return 0;
+
+err_opt:
+    perror("AF_XDP ring setup");
+err:
+    xsk_close(xsk);
+    return -1;
+}
+
+/* Let the kernel process the TX ring, only when it asks for it */
+static void xsk_kick(xsk_t *xsk)
+{
+    if (xsk->need_wakeup &&
+        !(__atomic_load_n(xsk->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP))
+        return;
+    sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+/* Return completed frames to the free list */
+static void xsk_reap(xsk_t *xsk)
+{
+    uint32_t prod = __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE);
+    uint32_t cons = *xsk->comp.consumer;
+    const uint64_t *addrs = xsk->comp.descs;
+
+    for (; cons != prod; cons++)
+        xsk->free_frames[xsk->nfree++] = addrs[cons & (xsk->comp.size - 1)];
+    __atomic_store_n(xsk->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take up to n free umem frames for the next batch and point iovs at
+ * them. When none are free, kick the kernel and wait for completions.
+ */
+static int xsk_reserve(xsk_t *xsk, struct iovec *iovs, int n)
+{
+    uint32_t tx_free;
+    int j;
+
+    xsk_reap(xsk);
+    if (xsk->nfree == 0) {
+        struct pollfd pfd = {
+            .fd = xsk->fd,
+            .events = POLLOUT,
+        };
+
+        xsk_kick(xsk);
+        poll(&pfd, 1, 1);
+        xsk_reap(xsk);
+    }
+
+    tx_free = xsk->tx.size - (*xsk->tx.producer - __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE));
+    if ((uint32_t)n > tx_free)
+        n = tx_free;
+    if ((uint32_t)n > xsk->nfree)
+        n = xsk->nfree;
+
+    for (j = 0; j < n; j++) {
+        xsk->batch[j] = xsk->free_frames[--xsk->nfree];
+        iovs[j].iov_base = xsk->umem + xsk->batch[j];
+    }
+
+    return n;
+}
+
+/* Put back the reserved frames [n, reserved) the batch did not use */
+static void xsk_unreserve(xsk_t *xsk, int n, int reserved)
+{
+    while (reserved > n)
+        xsk->free_frames[xsk->nfree++] = xsk->batch[--reserved];
+}
+
+/* Wait up to a second for frames still in flight before closing */
+static void xsk_drain(xsk_t *xsk)
+{
+    uint64_t deadline = now_ns() + NSEC_PER_SEC;
+
+    xsk_reap(xsk);
+    while (xsk->nfree < XSK_NUM_FRAMES && now_ns() < deadline) {
+        struct pollfd pfd = {
+            .fd = xsk->fd,
+            .events = POLLOUT,
+        };
+
+        xsk_kick(xsk);
+        poll(&pfd, 1, 1);
+        xsk_reap(xsk);
+    }
+}
+
+/*
+ * Post the reserved frames as TX descriptors. Frames that do not live in
+ * the umem, as in --pcap mode, are copied into their reserved frame, none
+ * is larger than a umem frame as checked when the socket was opened.
+ */
+static int xsk_submit(xsk_t *xsk, const struct iovec *iovs, int n)
+{
+    uint32_t prod = *xsk->tx.producer;
+    struct xdp_desc *descs = xsk->tx.descs;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        struct xdp_desc *desc = &descs[(prod + j) & (xsk->tx.size - 1)];
+        uint8_t *frame = xsk->umem + xsk->batch[j];
+        uint32_t len = iovs[j].iov_len;
+
+        if (iovs[j].iov_base != frame)
+            memcpy(frame, iovs[j].iov_base, len);
+        desc->addr = xsk->batch[j];
+        desc->len = len;
+        desc->options = 0;
+    }
+    __atomic_store_n(xsk->tx.producer, prod + n, __ATOMIC_RELEASE);
+    xsk_kick(xsk);
+
+    return n;
+}
+
+/*
+ * io_uring engine of one thread. Every in-flight send owns a slot with
+ * its own frame, iovec and msghdr, since the kernel reads them after
+ * submission. Slots are recycled when their completion is reaped.
+ */
+typedef struct {
+    struct msghdr msg;
+    struct iovec iov;
+} uring_slot_t;
+
+typedef struct {
+    int fd;
+    int sockfd;
+    int sqpoll;
+    int zc;
+    uint32_t depth;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_flags;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    uint8_t *frames;
+    uring_slot_t *slots;
+    uint32_t *free_slots;
+    uint32_t nfree;
+    /* Slot of each frame of the current batch */
+    uint32_t *batch;
+    /* Sends that completed with an error, see uring_take_failed() */
+    uint32_t failed;
+} uring_t;
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_close(uring_t *ur)
+{
+    if (ur->sqes)
+        munmap(ur->sqes, ur->sqes_len);
+    if (ur->cq_map && ur->cq_map != ur->sq_map)
+        munmap(ur->cq_map, ur->cq_map_len);
+    if (ur->sq_map)
+        munmap(ur->sq_map, ur->sq_map_len);
+    if (ur->fd >= 0)
+        close(ur->fd);
+    free(ur->frames);
+    free(ur->slots);
+    free(ur->free_slots);
+    free(ur->batch);
+    ur->fd = -1;
+}
+
+/*
+ * Set up a ring of uring_depth entries sending on sockfd. With SQPOLL a
+ * kernel thread polls the submission queue, so steady state sending needs
+ * no syscalls at all.
+ */
+static int uring_open(const sender_thread_t *thread, uring_t *ur, int sockfd)
+{
+    const sender_params_t *sender_params = thread->params;
+    struct io_uring_params params = {};
+    uint32_t i;
+
+    memset(ur, 0, sizeof(*ur));
+    ur->sockfd = sockfd;
+    ur->depth = sender_params->uring_depth;
+    ur->sqpoll = sender_params->uring_sqpoll;
+#ifdef IORING_CQE_F_NOTIF
+    ur->zc = sender_params->uring_zc;
+#else
+    if (sender_params->uring_zc)
+        fprintf(stderr, "zero-copy send not supported by these kernel headers\n");
+#endif
+
+    /* Zero-copy sends complete twice, room for both */
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = ur->depth * 2;
+    if (ur->sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;
+    }
+    ur->fd = syscall(__NR_io_uring_setup, ur->depth, &params);
+    if (ur->fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    ur->depth = params.sq_entries;
+
+    ur->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ur->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_map_len > ur->sq_map_len)
+            ur->sq_map_len = ur->cq_map_len;
+        ur->cq_map_len = ur->sq_map_len;
+    }
+    ur->sq_map = mmap(NULL, ur->sq_map_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    if (ur->sq_map == MAP_FAILED) {
+        ur->sq_map = NULL;
+        goto err;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_map = ur->sq_map;
+    } else {
+        ur->cq_map = mmap(NULL, ur->cq_map_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+        if (ur->cq_map == MAP_FAILED) {
+            ur->cq_map = NULL;
+            goto err;
+        }
+    }
+    ur->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        ur->sqes = NULL;
+        goto err;
+    }
+
+    ur->sq_head = (uint32_t *)((uint8_t *)ur->sq_map + params.sq_off.head);
+    ur->sq_tail = (uint32_t *)((uint8_t *)ur->sq_map + params.sq_off.tail);
+    ur->sq_mask = (uint32_t *)((uint8_t *)ur->sq_map + params.sq_off.ring_mask);
+    ur->sq_flags = (uint32_t *)((uint8_t *)ur->sq_map + params.sq_off.flags);
+    ur->sq_array = (uint32_t *)((uint8_t *)ur->sq_map + params.sq_off.array);
+    ur->cq_head = (uint32_t *)((uint8_t *)ur->cq_map + params.cq_off.head);
+    ur->cq_tail = (uint32_t *)((uint8_t *)ur->cq_map + params.cq_off.tail);
+    ur->cq_mask = (uint32_t *)((uint8_t *)ur->cq_map + params.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)((uint8_t *)ur->cq_map + params.cq_off.cqes);
+
+    ur->frames = malloc((size_t)thread->tx_len * ur->depth);
+    ur->slots = calloc(ur->depth, sizeof(uring_slot_t));
+    ur->free_slots = calloc(ur->depth, sizeof(uint32_t));
+    ur->batch = calloc(ur->depth, sizeof(uint32_t));
+    if (ur->frames == NULL || ur->slots == NULL || ur->free_slots == NULL || ur->batch == NULL) {
+        perror("malloc");
+        uring_close(ur);
+        return -1;
+    }
+    for (i = 0; i < ur->depth; i++) {
+        uring_slot_t *slot = &ur->slots[i];
+
+        memcpy(ur->frames + (size_t)i * thread->tx_len, thread->frame, thread->tx_len);
+        slot->iov.iov_base = ur->frames + (size_t)i * thread->tx_len;
+        slot->msg.msg_name = (void *)&thread->socket_address;
+        slot->msg.msg_namelen = sizeof(struct sockaddr_ll);
+        slot->msg.msg_iov = &slot->iov;
+        slot->msg.msg_iovlen = 1;
+        ur->free_slots[ur->nfree++] = i;
+    }
+
+    return 0;
+
+err:
+    perror("mmap(io_uring)");
+    uring_close(ur);
+    return -1;
+}
+
+/* Recycle the slots of completed sends, failed sends count as errors */
+static void uring_reap(sender_thread_t *thread, uring_t *ur)
+{
+    uint32_t head = *ur->cq_head;
+    uint32_t tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+
+        if (cqe->res < 0) {
+            /* Counted as sent on submission, take it back */
+            ur->failed++;
+            STATS_ADD(thread->stats.sent, -1);
+            STATS_ADD(thread->stats.bytes, -ur->slots[cqe->user_data].iov.iov_len);
+            if (-cqe->res < MAX_ERRNO)
+                STATS_ADD(thread->stats.errors[-cqe->res], 1);
+            if (cqe->res == -EOPNOTSUPP && ur->zc) {
+                fprintf(stderr, "thread %d: zero-copy send not supported, using SENDMSG\n",
+                        thread->id);
+                ur->zc = 0;
+            }
+        }
+#ifdef IORING_CQE_F_NOTIF
+        /* Zero-copy: the buffer is only free again after the notification */
+        if (cqe->flags & IORING_CQE_F_MORE)
+            continue;
+#endif
+        ur->free_slots[ur->nfree++] = cqe->user_data;
+    }
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take up to n free slots for the next batch and point iovs at their
+ * frames. When all slots are in flight, wait for a completion.
+ */
+static int uring_reserve(sender_thread_t *thread, uring_t *ur, struct iovec *iovs, int n)
+{
+    int j;
+
+    uring_reap(thread, ur);
+    if (ur->nfree == 0) {
+        uring_enter(ur->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        uring_reap(thread, ur);
+    }
+
+    if ((uint32_t)n > ur->nfree)
+        n = ur->nfree;
+    for (j = 0; j < n; j++) {
+        ur->batch[j] = ur->free_slots[--ur->nfree];
+        iovs[j].iov_base = ur->frames + (size_t)ur->batch[j] * thread->tx_len;
+    }
+
+    return n;
+}
+
+/* Put back the reserved slots [n, reserved) the batch did not use */
+static void uring_unreserve(uring_t *ur, int n, int reserved)
+{
+    while (reserved > n)
+        ur->free_slots[ur->nfree++] = ur->batch[--reserved];
+}
+
+/*
+ * Queue one SENDMSG (or SENDMSG_ZC) per frame and submit them all with
+ * at most one syscall, none with SQPOLL unless its thread went idle.
+ * Frames outside the slot buffers, as in --pcap mode, are sent in place.
+ */
+static int uring_submit(uring_t *ur, const struct iovec *iovs, int n)
+{
+    uint32_t tail = *ur->sq_tail;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        uint32_t idx = (tail + j) & *ur->sq_mask;
+        struct io_uring_sqe *sqe = &ur->sqes[idx];
+        uring_slot_t *slot = &ur->slots[ur->batch[j]];
+
+        slot->iov = iovs[j];
+        memset(sqe, 0, sizeof(*sqe));
+#ifdef IORING_CQE_F_NOTIF
+        sqe->opcode = ur->zc ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+#else
+        sqe->opcode = IORING_OP_SENDMSG;
+#endif
+        sqe->fd = ur->sockfd;
+        sqe->addr = (uintptr_t)&slot->msg;
+        sqe->len = 1;
+        sqe->user_data = ur->batch[j];
+        ur->sq_array[idx] = idx;
+    }
+    __atomic_store_n(ur->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    if (!ur->sqpoll)
+        uring_enter(ur->fd, n, 0, 0);
+    else if (__atomic_load_n(ur->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+        uring_enter(ur->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+
+    return n;
+}
+
+/*
+ * Number of sends that failed since the last call. Failures only show on
+ * completion, the frames are sent again to make up --count.
+ */
+static uint32_t uring_take_failed(uring_t *ur)
+{
+    uint32_t failed = ur->failed;
+
+    ur->failed = 0;
+    return failed;
+}
+
+/* Wait for all sends in flight before closing */
+static void uring_drain(sender_thread_t *thread, uring_t *ur)
+{
+    uring_reap(thread, ur);
+    while (ur->nfree < ur->depth) {
+        if (uring_enter(ur->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            break;
+        uring_reap(thread, ur);
+    }
+}
+
+/*
+ * TX timestamps of the AF_PACKET socket: the kernel reports every frame
+ * when it enters the qdisc (SCHED), when the driver hands it to the
+ * device (SND, software) and, where the driver supports it, when it
+ * leaves the NIC (SND, hardware). OPT_ID numbers the reports per frame
+ * sent on the socket, which finds the time of the send call in
+ * tx_slots. Hardware stamps are in PHC time and only comparable when
+ * the PHC is synced to CLOCK_REALTIME, e.g. by phc2sys.
+ */
+static int tx_stamp_enable(sender_thread_t *thread, int sockfd)
+{
+    int flags = SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_SOFTWARE |
+                SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+                SOF_TIMESTAMPING_OPT_TSONLY;
+    /* Room for the reports of a few drain intervals */
+    int rcvbuf = 4 * 1024 * 1024;
+
+    if (thread->params->tx_timestamp == TX_STAMP_HARDWARE)
+        flags |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        perror("SO_TIMESTAMPING");
+        return -1;
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    thread->tx_slots = calloc(TX_STAMP_RING, sizeof(tx_stamp_slot_t));
+    if (thread->tx_slots == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Hardware TX timestamps have to be switched on in the device, the RX
+ * filter is left as it is, e.g. for ptp4l.
+ */
+static void tx_stamp_enable_hw(int sockfd, const char *interface)
 {
-    int val;
-    int option_index = 0;
-    sender_params_t *sender_params = params;
+    struct hwtstamp_config config = {};
+    struct ifreq ifr = {};
 
-    const struct option long_options[] = {
-        {"interface", required_argument, NULL, 'I'},
-        {"interval", required_argument, NULL, 'i'},
-        {"count", required_argument, NULL, 'c'},
-        {"packetsize", required_argument, NULL, 's'},
-        {"dst_mac", required_argument, NULL, 'm'},
-        {"ether_proto", required_argument, NULL, 'p'},
-        {"data", required_argument, NULL, 'd'},
-        {0, 0, 0, 0},
-    };
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", interface);
+    ifr.ifr_data = (void *)&config;
+    if (ioctl(sockfd, SIOCGHWTSTAMP, &ifr) < 0)
+        config.rx_filter = HWTSTAMP_FILTER_NONE;
+    config.tx_type = HWTSTAMP_TX_ON;
+    if (ioctl(sockfd, SIOCSHWTSTAMP, &ifr) < 0)
+        fprintf(stderr, "no hardware TX timestamps on %s (%s), software only\n",
+                interface, strerror(errno));
+}
+
+/*
+ * Send time of the n frames a send call accepted out of asked. A call
+ * that stopped short may have had the frame after them keyed and then
+ * dropped, e.g. by a full qdisc, which gets a slot of its own.
+ */
+static void tx_stamp_record(sender_thread_t *thread, int n, int asked, uint64_t sent)
+{
+    int slots = n < asked ? n + 1 : n;
+    int j;
+
+    for (j = 0; j < slots; j++) {
+        tx_stamp_slot_t *slot = &thread->tx_slots[(thread->tx_next_id + j) & (TX_STAMP_RING - 1)];
+
+        slot->sent = sent;
+        slot->sched = 0;
+        slot->dropped = j == n;
+    }
+    thread->tx_next_id += slots;
+}
+
+static void account_tx_latency(tx_latency_t *lat, int64_t latency)
+{
+    int bucket = 0;
+
+    /* PHC not synced to the system clock */
+    if (latency < 0)
+        latency = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && (uint64_t)latency >= (1ULL << bucket))
+        bucket++;
+    lat->hist[bucket]++;
+
+    if (lat->count == 0 || (uint64_t)latency < lat->min)
+        lat->min = latency;
+    if ((uint64_t)latency > lat->max)
+        lat->max = latency;
+    lat->sum += latency;
+    lat->count++;
+}
+
+/*
+ * The kernel takes an OPT_ID key for every frame it accepted, also for
+ * those it drops afterwards, so its keys are not always those counted
+ * in tx_slots. SCHED stamps are taken within the send call, after its
+ * send time and before the next call's: when the frame of a key was
+ * sent after its stamp or the next call was before it, move to the
+ * frame sent last before the stamp and shift the keys from there on.
+ */
+static uint32_t tx_stamp_resync(sender_thread_t *thread, uint32_t key, uint64_t ts)
+{
+    const tx_stamp_slot_t *slots = thread->tx_slots;
+    uint32_t last = thread->tx_next_id - 1;
+    uint32_t id = key - thread->tx_id_skew;
 
+    /* Key of a frame not counted as sent yet */
+    if ((uint32_t)(id - thread->tx_next_id) < TX_STAMP_RING)
+        id = last;
+    /* Too old to tell */
+    if ((uint32_t)(last - id) >= TX_STAMP_RING)
+        return id;
+
+    while ((uint32_t)(last - id) < TX_STAMP_RING - 1 && slots[id & (TX_STAMP_RING - 1)].sent > ts)
+        id--;
+    while (id != last && slots[(id + 1) & (TX_STAMP_RING - 1)].sent <= ts &&
+           slots[(id + 1) & (TX_STAMP_RING - 1)].sent != slots[id & (TX_STAMP_RING - 1)].sent)
+        id++;
+    thread->tx_id_skew = key - id;
+
+    return id;
+}
+
+static void tx_stamp_account(sender_thread_t *thread, struct msghdr *msg)
+{
+    struct scm_timestamping *tss = NULL;
+    struct sock_extended_err *serr = NULL;
+    struct cmsghdr *cm;
+    tx_stamp_slot_t *slot;
+    uint32_t id;
+    uint64_t ts;
+
+    for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING)
+            tss = (struct scm_timestamping *)CMSG_DATA(cm);
+        else if (cm->cmsg_level == SOL_PACKET && cm->cmsg_type == PACKET_TX_TIMESTAMP)
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+    }
+    if (tss == NULL || serr == NULL || serr->ee_errno != ENOMSG ||
+        serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+        return;
+
+    ts = tss->ts[0].tv_sec * NSEC_PER_SEC + tss->ts[0].tv_nsec;
+    id = serr->ee_data - thread->tx_id_skew;
+    if (serr->ee_info == SCM_TSTAMP_SCHED)
+        id = tx_stamp_resync(thread, serr->ee_data, ts);
+    /* Only the send times of the last TX_STAMP_RING frames are kept */
+    if ((uint32_t)(thread->tx_next_id - id - 1) >= TX_STAMP_RING) {
+        thread->tx_unmatched++;
+        return;
+    }
+    slot = &thread->tx_slots[id & (TX_STAMP_RING - 1)];
+    /* Frame never sent */
+    if (slot->dropped)
+        return;
+
+    if (serr->ee_info == SCM_TSTAMP_SCHED) {
+        slot->sched = ts;
+        account_tx_latency(&thread->tx_latency[TX_STAGE_SCHED], ts - slot->sent);
+    } else if (serr->ee_info == SCM_TSTAMP_SND && ts) {
+        account_tx_latency(&thread->tx_latency[TX_STAGE_SOFTWARE], ts - slot->sent);
+        if (slot->sched)
+            account_tx_latency(&thread->tx_latency[TX_STAGE_QUEUE], ts - slot->sched);
+    } else if (serr->ee_info == SCM_TSTAMP_SND) {
+        /* Hardware stamp, ts[0] is zero */
+        ts = tss->ts[2].tv_sec * NSEC_PER_SEC + tss->ts[2].tv_nsec;
+        account_tx_latency(&thread->tx_latency[TX_STAGE_HARDWARE], ts - slot->sent);
+    }
+}
+
+/*
+ * Read the timestamp reports off the error queue in batches. Without a
+ * linger time only what is queued already, otherwise until no report
+ * came for linger_ms.
+ */
+static void tx_stamp_drain(sender_thread_t *thread, int sockfd, int linger_ms)
+{
+    struct mmsghdr msgs[TX_STAMP_BATCH];
+    char control[TX_STAMP_BATCH][256];
+    int i, n;
+
+    thread->tx_drained_id = thread->tx_next_id;
     while (1) {
-        val = getopt_long(argc, argv, "I:i:c:s:", long_options, &option_index);
-        if (val == -1) {
-            break;
+        if (linger_ms > 0) {
+            /* POLLERR is reported for a non-empty error queue */
+            struct pollfd pfd = { .fd = sockfd };
+
+            if (poll(&pfd, 1, linger_ms) <= 0)
+                break;
         }
 
-        switch (val) {
-        case 0:
-            printf("option %s", long_options[option_index].name);
-            if (optarg)
-                printf(" with arg %s", optarg);
-            printf("\n");
-            break;
-        case 'I':
-            strncpy(sender_params->interface, optarg, IFNAMSIZ - 1);
-            printf("option interface with value '%s'\n", sender_params->interface);
-            break;
-        case 'i':
-            sender_params->interval = strtoul(optarg, NULL, 0);
-            printf("option interval with value '%d'\n", sender_params->interval);
-            break;
-        case 'c':
-            sender_params->count = strtoul(optarg, NULL, 0);
-            printf("option count with value '%d'\n", sender_params->count);
-            break;
-        case 's':
-            sender_params->packetsize = strtoul(optarg, NULL, 0);
-            printf("option packetsize with value '%d'\n", sender_params->packetsize);
-            break;
-        case 'm':
-            sscanf(optarg, "%02x:%02x:%02x:%02x:%02x:%02x",
-                   &sender_params->ether_mac[0],
-                   &sender_params->ether_mac[1],
-                   &sender_params->ether_mac[2],
-                   &sender_params->ether_mac[3],
-                   &sender_params->ether_mac[4],
-                   &sender_params->ether_mac[5]);
-            printf("option dst_mac with value '%s'\n", optarg);
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < TX_STAMP_BATCH; i++) {
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+        n = recvmmsg(sockfd, msgs, TX_STAMP_BATCH, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            if (linger_ms > 0 && n < 0 && errno == EAGAIN)
+                continue;
             break;
-        case 'p':
-            sender_params->ether_proto = strtoul(optarg, NULL, 0);
-            printf("option ether_proto with value '0x%04x'\n", sender_params->ether_proto);
+        }
+        for (i = 0; i < n; i++)
+            tx_stamp_account(thread, &msgs[i].msg_hdr);
+        if (n < TX_STAMP_BATCH && linger_ms <= 0)
             break;
-        case 'd':
-            sender_params->data = (void *)optarg;
-            printf("option data with value '%s'\n", sender_params->data);
+    }
+}
+
+/*
+ * Send the first n frames of the batch. Returns the number of frames
+ * sent, 0 after backing off from a transient error or -1 on error.
+ */
+static int send_frames(sender_thread_t *thread, int sockfd, struct iovec *iovs,
+                       struct mmsghdr *msgs, int n, uint64_t *backoff_ns)
+{
+    if (thread->params->batch == 1) {
+        /* Send packet */
+        n = sendto(sockfd, iovs[0].iov_base, iovs[0].iov_len, 0,
+                   (struct sockaddr *)&thread->socket_address,
+                   sizeof(struct sockaddr_ll)) < 0 ? -1 : 1;
+    } else {
+        /* Send batch of packets */
+        n = sendmmsg(sockfd, msgs, n, 0);
+    }
+
+    if (n < 0) {
+        int err = errno;
+
+        if (err < MAX_ERRNO)
+            STATS_ADD(thread->stats.errors[err], 1);
+        /* Queue full or interrupted: back off and retry */
+        if (err == ENOBUFS || err == EAGAIN || err == EINTR) {
+            backoff(backoff_ns);
+            return 0;
+        }
+        perror(thread->params->batch == 1 ? "sendto" : "sendmmsg");
+        return -1;
+    }
+
+    *backoff_ns = 0;
+    return n;
+}
+
+static void *sender_thread(void *arg)
+{
+    sender_thread_t *thread = arg;
+    const sender_params_t *sender_params = thread->params;
+    int tx_len = thread->tx_len;
+    char *sendbuf = NULL;
+    struct iovec *iovs = NULL;
+    struct mmsghdr *msgs = NULL;
+    xsk_t xsk = { .fd = -1 };
+    uring_t uring = { .fd = -1 };
+    int i, sockfd = -1;
+
+    if (thread->cpu >= 0) {
+        cpu_set_t cpuset;
+
+        CPU_ZERO(&cpuset);
+        CPU_SET(thread->cpu, &cpuset);
+        /* Pinning also selects the TX queue when XPS maps cpus to queues */
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+            fprintf(stderr, "thread %d: failed to pin to cpu %d\n", thread->id, thread->cpu);
+    }
+
+    if (sender_params->engine == ENGINE_XDP) {
+        /* AF_XDP socket on its own queue */
+        if ((thread->pcap ? thread->pcap->max_len : (uint32_t)thread->tx_len) > XSK_FRAME_SIZE) {
+            fprintf(stderr, "frames larger than %d bytes do not fit AF_XDP umem frames\n",
+                    XSK_FRAME_SIZE);
+            thread->ret = -1;
+            goto end;
+        }
+        if (xsk_open(thread, &xsk, thread->socket_address.sll_ifindex) < 0) {
+            thread->ret = -1;
+            goto end;
+        }
+    } else if ((sockfd = socket(AF_PACKET, SOCK_RAW, 0)) == -1) {
+        /*
+         * Open RAW socket to send on, one per thread. Protocol 0 keeps it
+         * send-only, so it is not handed a copy of every frame on the host.
+         */
+        perror("socket");
+        thread->ret = -1;
+        goto end;
+    } else if (sender_params->engine == ENGINE_URING &&
+               uring_open(thread, &uring, sockfd) < 0) {
+        thread->ret = -1;
+        goto end;
+    } else if (sender_params->tx_timestamp && tx_stamp_enable(thread, sockfd) < 0) {
+        thread->ret = -1;
+        goto end;
+    }
+
+    /*
+     * Each thread sends from its own copies of the frame, one per message
+     * of a batch, so every frame can carry its own sequence stamp.
+     */
+    sendbuf = malloc((size_t)tx_len * sender_params->batch);
+    iovs = calloc(sender_params->batch, sizeof(struct iovec));
+    msgs = calloc(sender_params->batch, sizeof(struct mmsghdr));
+    if (sendbuf == NULL || iovs == NULL || msgs == NULL) {
+        perror("malloc");
+        thread->ret = -1;
+        goto end;
+    }
+    for (i = 0; i < sender_params->batch; i++) {
+        memcpy(sendbuf + (size_t)i * tx_len, thread->frame, tx_len);
+        iovs[i].iov_base = sendbuf + (size_t)i * tx_len;
+        iovs[i].iov_len = tx_len;
+        msgs[i].msg_hdr.msg_name = &thread->socket_address;
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    uint64_t busy_poll_ns = sender_params->busy_poll * NSEC_PER_USEC;
+    uint64_t backoff_ns = 0;
+    uint64_t sent = 0;
+    uint64_t start = now_ns();
+    __atomic_store_n(&thread->start, start, __ATOMIC_RELAXED);
+
+    i = thread->count;
+    while (i && !stop_sending) {
+        uint64_t idle_ns = 0;
+        int n = sender_params->batch;
+        if (thread->pps > 0) {
+            /* Send whatever is due, at most one batch at a time */
+            uint64_t due = pace_wait(start, sent, thread->pps, busy_poll_ns, &idle_ns);
+            if (due < (uint64_t)n)
+                n = due;
+        }
+        /* Last batch may be partial */
+        if (i > 0 && i < n)
+            n = i;
+
+        uint64_t bytes = 0;
+        int j, reserved;
+
+        /* AF_XDP sends from free umem frames, wait for some if needed */
+        if (xsk.fd >= 0) {
+            n = xsk_reserve(&xsk, iovs, n);
+            if (n == 0)
+                continue;
+        }
+        /* io_uring likewise from free slots */
+        if (uring.fd >= 0)
+            n = uring_reserve(thread, &uring, iovs, n);
+        reserved = n;
+
+        if (thread->pcap) {
+            /* Frames straight from the mapped capture */
+            n = pcap_fill(thread, iovs, n, sent, start, busy_poll_ns, &idle_ns);
+            /* Frames not yet due go back for the next round */
+            if (xsk.fd >= 0)
+                xsk_unreserve(&xsk, n, reserved);
+            if (uring.fd >= 0)
+                uring_unreserve(&uring, n, reserved);
+            for (j = 0; j < n; j++)
+                bytes += iovs[j].iov_len;
+        } else {
+            /* Patch size, flow and stamp into the pre-built frames */
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            for (j = 0; j < n; j++) {
+                iovs[j].iov_len = patch_frame(thread, iovs[j].iov_base, sent + j, &ts);
+                bytes += iovs[j].iov_len;
+            }
+        }
+
+        if (xsk.fd >= 0) {
+            n = xsk_submit(&xsk, iovs, n);
+        } else if (uring.fd >= 0) {
+            n = uring_submit(&uring, iovs, n);
+        } else if (thread->tx_slots) {
+            /* Send time of the frames for their TX timestamps */
+            uint64_t call = realtime_ns();
+            int asked = n;
+
+            n = send_frames(thread, sockfd, iovs, msgs, n, &backoff_ns);
+            if (n >= 0)
+                tx_stamp_record(thread, n, asked, call);
+            if (thread->tx_next_id - thread->tx_drained_id >= TX_STAMP_DRAIN)
+                tx_stamp_drain(thread, sockfd, 0);
+        } else {
+            n = send_frames(thread, sockfd, iovs, msgs, n, &backoff_ns);
+        }
+        if (n < 0) {
+            thread->ret = -1;
             break;
         }
+        /* Partially sent batch, the rest is prepared again next round */
+        for (; j > n; j--)
+            bytes -= iovs[j - 1].iov_len;
+        sent += n;
+        if (i > 0)
+            i -= n;
+        /* Count only io_uring sends that completed, the last batch waits for all */
+        if (uring.fd >= 0 && i >= 0) {
+            uint32_t failed;
+
+            if (i == 0)
+                uring_drain(thread, &uring);
+            failed = uring_take_failed(&uring);
+            if (failed)
+                backoff(&backoff_ns);
+            else
+                backoff_ns = 0;
+            i += failed;
+        }
+
+        /* Sleep for a while, unless paced by --pps/--rate or the capture */
+        if (thread->pps <= 0 && !thread->pcap && sender_params->interval > 0) {
+            usleep(sender_params->interval * 1000);
+            idle_ns += sender_params->interval * NSEC_PER_MSEC;
+        }
+
+        STATS_ADD(thread->stats.sent, n);
+        STATS_ADD(thread->stats.bytes, bytes);
+        if (idle_ns)
+            STATS_ADD(thread->stats.idle_ns, idle_ns);
+    }
+
+    if (xsk.fd >= 0)
+        xsk_drain(&xsk);
+    if (uring.fd >= 0)
+        uring_drain(thread, &uring);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    __atomic_store_n(&thread->cpu_ns, ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_store_n(&thread->end, now_ns(), __ATOMIC_RELAXED);
+
+    /* Reports of the last frames, outside of the measured send time */
+    if (thread->tx_slots)
+        tx_stamp_drain(thread, sockfd, TX_STAMP_LINGER_MS);
+
+end:
+    if (sockfd >= 0)
+        close(sockfd);
+    xsk_close(&xsk);
+    uring_close(&uring);
+    free(msgs);
+    free(iovs);
+    free(sendbuf);
+    free(thread->tx_slots);
+    thread->tx_slots = NULL;
+    __atomic_store_n(&thread->running, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Snapshot of the counters of all threads, summed up */
+typedef struct {
+    uint64_t time;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    sender_stats_t stats;
+} sender_sample_t;
+
+static void sample_stats(sender_thread_t *threads, int nthreads, sender_sample_t *sample)
+{
+    int i, e;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->time = now_ns();
+
+    for (i = 0; i < nthreads; i++) {
+        sender_thread_t *thread = &threads[i];
+        clockid_t cid;
+        struct timespec ts;
+
+        if (thread->count == 0)
+            continue;
+        sample->stats.sent += STATS_READ(thread->stats.sent);
+        sample->stats.bytes += STATS_READ(thread->stats.bytes);
+        sample->stats.idle_ns += STATS_READ(thread->stats.idle_ns);
+        for (e = 0; e < MAX_ERRNO; e++)
+            sample->stats.errors[e] += STATS_READ(thread->stats.errors[e]);
+
+        uint64_t start = __atomic_load_n(&thread->start, __ATOMIC_RELAXED);
+        uint64_t end = __atomic_load_n(&thread->end, __ATOMIC_RELAXED);
+        if (start == 0)
+            continue;
+        if (end) {
+            /* Finished, cpu time was recorded by the thread itself */
+            sample->wall_ns += end - start;
+            sample->cpu_ns += __atomic_load_n(&thread->cpu_ns, __ATOMIC_RELAXED);
+        } else {
+            sample->wall_ns += sample->time - start;
+            if (pthread_getcpuclockid(thread->tid, &cid) == 0 && clock_gettime(cid, &ts) == 0)
+                sample->cpu_ns += ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+        }
     }
 }
 
-int main(int argc, char *argv[])
+static uint64_t sum_errors(const sender_stats_t *stats)
+{
+    uint64_t errors = 0;
+    int e;
+
+    for (e = 0; e < MAX_ERRNO; e++)
+        errors += stats->errors[e];
+
+    return errors;
+}
+
+/*
+ * Threads are off cpu either idle (interval/pacing sleeps) or blocked
+ * (socket buffer full, ENOBUFS backoff, waiting for a cpu), so blocked
+ * time is the wall time of all threads minus their cpu and idle time.
+ */
+static double blocked_seconds(const sender_sample_t *cur, const sender_sample_t *prev)
+{
+    int64_t blocked = (int64_t)(cur->wall_ns - prev->wall_ns) -
+                      (int64_t)(cur->cpu_ns - prev->cpu_ns) -
+                      (int64_t)(cur->stats.idle_ns - prev->stats.idle_ns);
+
+    return blocked > 0 ? (double)blocked / NSEC_PER_SEC : 0;
+}
+
+static void merge_tx_latency(tx_latency_t *total, const tx_latency_t *lat)
+{
+    int stage, i;
+
+    for (stage = 0; stage < TX_STAGES; stage++) {
+        if (lat[stage].count == 0)
+            continue;
+        if (total[stage].count == 0 || lat[stage].min < total[stage].min)
+            total[stage].min = lat[stage].min;
+        if (lat[stage].max > total[stage].max)
+            total[stage].max = lat[stage].max;
+        total[stage].count += lat[stage].count;
+        total[stage].sum += lat[stage].sum;
+        for (i = 0; i < LATENCY_BUCKETS; i++)
+            total[stage].hist[i] += lat[stage].hist[i];
+    }
+}
+
+static void print_tx_latency(const tx_latency_t *lat, uint64_t sent, uint64_t unmatched)
+{
+    int stage, i;
+
+    printf("tx timestamps: %llu frames, %llu qdisc, %llu software, %llu hardware, %llu unmatched\n",
+           (unsigned long long)sent, (unsigned long long)lat[TX_STAGE_SCHED].count,
+           (unsigned long long)lat[TX_STAGE_SOFTWARE].count,
+           (unsigned long long)lat[TX_STAGE_HARDWARE].count, (unsigned long long)unmatched);
+
+    for (stage = 0; stage < TX_STAGES; stage++) {
+        if (lat[stage].count == 0)
+            continue;
+        printf("%s: min %llu ns, avg %llu ns, max %llu ns\n", tx_stage_names[stage],
+               (unsigned long long)lat[stage].min,
+               (unsigned long long)(lat[stage].sum / lat[stage].count),
+               (unsigned long long)lat[stage].max);
+        for (i = 0; i < LATENCY_BUCKETS; i++) {
+            if (lat[stage].hist[i] == 0)
+                continue;
+            printf("  < %12llu ns: %llu\n", 1ULL << i, (unsigned long long)lat[stage].hist[i]);
+        }
+    }
+}
+
+static void print_interval(const sender_sample_t *cur, const sender_sample_t *prev,
+                           const sender_sample_t *first)
+{
+    double elapsed = (double)(cur->time - prev->time) / NSEC_PER_SEC;
+    uint64_t sent = cur->stats.sent - prev->stats.sent;
+    uint64_t bytes = cur->stats.bytes - prev->stats.bytes;
+
+    printf("[%8.3f s] sent %llu packets, %llu bytes, %.0f pps, %.3f Gbit/s, %llu errors, blocked %.3f s\n",
+           (double)(cur->time - first->time) / NSEC_PER_SEC,
+           (unsigned long long)sent, (unsigned long long)bytes,
+           elapsed > 0 ? sent / elapsed : 0,
+           elapsed > 0 ? bytes * 8 / elapsed / 1e9 : 0,
+           (unsigned long long)(sum_errors(&cur->stats) - sum_errors(&prev->stats)),
+           blocked_seconds(cur, prev));
+    fflush(stdout);
+}
+
+static const char *const engine_names[] = {
+    [ENGINE_PACKET] = "packet",
+    [ENGINE_XDP] = "xdp",
+    [ENGINE_URING] = "uring",
+};
+
+/*
+ * Result record of the run for --json. Latency is the send path up to
+ * the wire, or up to the driver without hardware stamps.
+ */
+static void write_result(const sender_params_t *params, const sender_sample_t *cur,
+                         const sender_sample_t *first, double elapsed, int tx_len,
+                         const tx_latency_t *tx_latency)
+{
+    const tx_latency_t *lat = &tx_latency[TX_STAGE_HARDWARE];
+    FILE *f = l2_result_open(params->json);
+
+    if (f == NULL) {
+        perror(params->json);
+        return;
+    }
+    if (lat->count == 0)
+        lat = &tx_latency[TX_STAGE_SOFTWARE];
+
+    l2_result_begin(f, "l2_packet_sender", engine_names[params->engine]);
+    fprintf(f, ", \"params\": {\"interface\": ");
+    l2_result_string(f, params->interface);
+    fprintf(f, ", \"frame_size\": %d, \"batch\": %d, \"threads\": %d, \"pps\": %.0f, \"count\": %d",
+            tx_len, params->batch, params->threads, params->pps, params->count);
+    if (params->sweep) {
+        fprintf(f, ", \"sweep\": ");
+        l2_result_string(f, params->sweep);
+    }
+    if (params->imix) {
+        fprintf(f, ", \"imix\": ");
+        l2_result_string(f, params->imix);
+    }
+    if (params->pcap) {
+        fprintf(f, ", \"pcap\": ");
+        l2_result_string(f, params->pcap);
+    }
+    fprintf(f, "}, \"duration_ns\": %llu, \"throughput\": %.0f, \"throughput_unit\": \"pps\"",
+            (unsigned long long)(elapsed * NSEC_PER_SEC), elapsed > 0 ? cur->stats.sent / elapsed : 0);
+    l2_result_latency(f, lat->hist, LATENCY_BUCKETS, lat->count, lat->sum, lat->min, lat->max);
+    fprintf(f, ", \"errors\": %llu, \"metrics\": {\"gbps\": %.3f, \"cpu_ns_per_pkt\": %.1f, "
+            "\"blocked_s\": %.3f}}\n",
+            (unsigned long long)sum_errors(&cur->stats),
+            elapsed > 0 ? cur->stats.bytes * 8 / elapsed / 1e9 : 0,
+            cur->stats.sent ? (double)cur->cpu_ns / cur->stats.sent : 0,
+            blocked_seconds(cur, first));
+    l2_result_close(f);
+}
+
+/*
+ * Whole sender run with command line style arguments. In a library the
+ * caller's SIGINT/SIGTERM handlers are restored on return.
+ */
+L2_SENDER_API int l2_sender_main(int argc, char *argv[])
 {
     int ret = 0;
+    struct sigaction stop_action = { .sa_handler = stop_handler };
+    struct sigaction old_int, old_term;
+    int handlers = 0;
     sender_params_t sender_params = {
         .interface = "eth0",
         .interval = 100,
         .packetsize = 0,
         .count = -1,
+        .batch = 1,
+        .threads = 1,
+        .stats_interval = 1,
+        .speed = 1.0,
+        .pcap_loops = 1,
+        .uring_depth = 256,
         .ether_proto = 0x8951,
         .data = "hello",
     };
 
+    /* Rescan the arguments when called more than once */
+    optind = 0;
+    stop_sending = 0;
     parse_command_line_options(argc, argv, &sender_params);
 
-    char *sendbuf = malloc(sender_params.packetsize);
-    if (sendbuf == NULL) {
-        perror("malloc");
-        return -1;
-    }
+    char *sendbuf = NULL;
+    sender_thread_t *threads = NULL;
+    uint16_t *sizes = NULL;
+    pcap_file_t pcap = {};
 
     int sockfd;
-    /* Open RAW socket to send on */
-    if ((sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1) {
+    /* Open RAW socket to query the interface */
+    if ((sockfd = socket(AF_PACKET, SOCK_RAW, 0)) == -1) {
         perror("socket");
-        free(sendbuf);
         return -1;
     }
 
@@ -136,6 +2173,7 @@ int main(int argc, char *argv[])
     }
 
     /* Use MTU size if packetsize is 0 */
+    int packetsize_set = sender_params.packetsize != 0;
     if (sender_params.packetsize == 0) {
         struct ifreq if_mtu = {};
         strncpy(if_mtu.ifr_name, sender_params.interface, IFNAMSIZ - 1);
@@ -147,9 +2185,70 @@ int main(int argc, char *argv[])
         sender_params.packetsize = if_mtu.ifr_mtu;
     }
 
+    /* TX timestamps are taken on the AF_PACKET socket of each thread */
+    if (sender_params.tx_timestamp && sender_params.engine != ENGINE_PACKET) {
+        fprintf(stderr, "--tx_timestamp needs the AF_PACKET engine\n");
+        ret = -1;
+        goto end;
+    }
+    if (sender_params.tx_timestamp == TX_STAMP_HARDWARE)
+        tx_stamp_enable_hw(sockfd, sender_params.interface);
+
+    close(sockfd);
+    sockfd = -1;
+
+    /* 802.1Q tag goes between source MAC and ethertype */
+    int hdr_len = sizeof(struct ether_header) + (sender_params.vlan_count ? VLAN_HLEN : 0);
+
+    /* Frame sizes sent in turn, one entry for a fixed size */
+    sizes = calloc(MAX_SIZES, sizeof(uint16_t));
+    if (sizes == NULL) {
+        perror("calloc");
+        ret = -1;
+        goto end;
+    }
+    int nsizes = 1;
+    if (sender_params.packetsize < 0 || sender_params.packetsize > UINT16_MAX - hdr_len) {
+        /* An MTU of 64k, e.g. on loopback, is more than a frame size can hold */
+        if (!packetsize_set) {
+            sender_params.packetsize = UINT16_MAX - hdr_len;
+        } else {
+            fprintf(stderr, "packetsize %d out of range, at most %d\n", sender_params.packetsize,
+                    UINT16_MAX - hdr_len);
+            ret = -1;
+            goto end;
+        }
+    }
+    sizes[0] = hdr_len + sender_params.packetsize;
+    if (sender_params.sweep)
+        nsizes = parse_sweep(sender_params.sweep, sizes, MAX_SIZES);
+    else if (sender_params.imix)
+        nsizes = parse_imix(sender_params.imix, sizes, MAX_SIZES);
+    if (nsizes <= 0) {
+        fprintf(stderr, "invalid size list '%s'\n",
+                sender_params.sweep ? sender_params.sweep : sender_params.imix);
+        ret = -1;
+        goto end;
+    }
+
+    /* Frame is built once at the largest size and cut short per packet */
+    int i, tx_len = 0;
+    double avg_len = 0;
+    for (i = 0; i < nsizes; i++) {
+        if (sizes[i] < hdr_len)
+            sizes[i] = hdr_len;
+        if (sizes[i] > tx_len)
+            tx_len = sizes[i];
+        avg_len += (double)sizes[i] / nsizes;
+    }
+
     /* Construct the Ethernet header */
-    int tx_len = sizeof(struct ether_header) + sender_params.packetsize;
-    memset(sendbuf, 0, sender_params.packetsize);
+    sendbuf = calloc(1, tx_len);
+    if (sendbuf == NULL) {
+        perror("calloc");
+        ret = -1;
+        goto end;
+    }
     /* Ethernet header */
     struct ether_header *eh = (struct ether_header *)sendbuf;
     eh->ether_shost[0] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[0];
@@ -164,19 +2263,29 @@ int main(int argc, char *argv[])
     eh->ether_dhost[3] = (uint8_t)sender_params.ether_mac[3];
     eh->ether_dhost[4] = (uint8_t)sender_params.ether_mac[4];
     eh->ether_dhost[5] = (uint8_t)sender_params.ether_mac[5];
-    /* Ethertype field */
-    eh->ether_type = htons(sender_params.ether_proto);
+    if (sender_params.vlan_count) {
+        /* VLAN tag, the id is patched per packet when rotating */
+        uint16_t *tag = (uint16_t *)(sendbuf + ETH_ALEN * 2);
+        tag[0] = htons(ETH_P_8021Q);
+        tag[1] = htons(sender_params.vlan & 0xfff);
+        tag[2] = htons(sender_params.ether_proto);
+    } else {
+        /* Ethertype field */
+        eh->ether_type = htons(sender_params.ether_proto);
+    }
 
     /* Packet data */
-    int i, len = strlen(sender_params.data);
-    for (i = 0; i < sender_params.packetsize; i++) {
-        sendbuf[i + sizeof(struct ether_header)] = sender_params.data[i % len];
+    int len = strlen(sender_params.data);
+    for (i = hdr_len; i < tx_len; i++) {
+        sendbuf[i] = sender_params.data[(i - hdr_len) % len];
     }
     sendbuf[tx_len - 1] = 0;
 
     struct sockaddr_ll socket_address = {};
     /* Index of the network device */
     socket_address.sll_ifindex = if_idx.ifr_ifindex;
+    /* Protocol of the frames sent */
+    socket_address.sll_protocol = htons(sender_params.ether_proto);
     /* Address length */
     socket_address.sll_halen = ETH_ALEN;
     /* Destination MAC */
@@ -187,22 +2296,174 @@ int main(int argc, char *argv[])
     socket_address.sll_addr[4] = (uint8_t)sender_params.ether_mac[4];
     socket_address.sll_addr[5] = (uint8_t)sender_params.ether_mac[5];
 
-    i = sender_params.count;
-    while (i--) {
-        /* Send packet */
-        if (sendto(sockfd, sendbuf, tx_len, 0,
-                   (struct sockaddr *)&socket_address,
-                   sizeof(struct sockaddr_ll)) < 0) {
-            perror("sendto");
+    /*
+     * Replay a capture instead of the built frame: --pcap_loops passes
+     * through the file unless --count says otherwise, 0 loops forever
+     */
+    if (sender_params.pcap) {
+        if (pcap_load(sender_params.pcap, &pcap) < 0) {
+            ret = -1;
+            goto end;
+        }
+        printf("pcap: %llu frames, %.3f s per pass\n", (unsigned long long)pcap.count,
+               (double)pcap.duration / NSEC_PER_SEC);
+        avg_len = pcap.avg_len;
+        if (sender_params.count < 0 && sender_params.pcap_loops > 0)
+            sender_params.count = pcap.count * sender_params.pcap_loops;
+    }
+
+    /* Bit rate is converted into packet rate of the L2 frames sent */
+    if (sender_params.rate > 0)
+        sender_params.pps = sender_params.rate / (avg_len * 8.0);
+
+    /* Threads are pinned to --cpus, or round robin to the allowed cpus */
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    if (sender_params.cpus) {
+        ncpus = parse_cpu_list(sender_params.cpus, cpus, CPU_SETSIZE);
+        if (ncpus <= 0) {
+            fprintf(stderr, "invalid cpu list '%s'\n", sender_params.cpus);
             ret = -1;
             goto end;
         }
-        /* Sleep for a while */
-        usleep(sender_params.interval * 1000);
+    } else {
+        cpu_set_t cpuset;
+        if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+            for (i = 0; i < CPU_SETSIZE; i++)
+                if (CPU_ISSET(i, &cpuset))
+                    cpus[ncpus++] = i;
+        }
+    }
+
+    threads = calloc(sender_params.threads, sizeof(sender_thread_t));
+    if (threads == NULL) {
+        perror("calloc");
+        ret = -1;
+        goto end;
+    }
+
+    sigaction(SIGINT, &stop_action, &old_int);
+    sigaction(SIGTERM, &stop_action, &old_term);
+    handlers = 1;
+
+    int nthreads = sender_params.threads;
+    for (i = 0; i < nthreads; i++) {
+        sender_thread_t *thread = &threads[i];
+
+        thread->params = &sender_params;
+        thread->id = i;
+        thread->cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+        thread->count = sender_params.count;
+        if (sender_params.count > 0)
+            thread->count = sender_params.count / nthreads +
+                            (i < sender_params.count % nthreads);
+        thread->pps = sender_params.pps / nthreads;
+        thread->frame = sendbuf;
+        thread->tx_len = tx_len;
+        thread->hdr_len = hdr_len;
+        thread->sizes = sizes;
+        thread->nsizes = nsizes;
+        thread->pcap = sender_params.pcap ? &pcap : NULL;
+        thread->socket_address = socket_address;
+        if (thread->count == 0)
+            continue;
+        thread->running = 1;
+        if (pthread_create(&thread->tid, NULL, sender_thread, thread) != 0) {
+            fprintf(stderr, "failed to create thread %d\n", i);
+            thread->count = 0;
+            thread->running = 0;
+            stop_sending = 1;
+            ret = -1;
+        }
     }
 
+    /* Live report every stats_interval seconds until all threads are done */
+    sender_sample_t first, prev, cur;
+    sample_stats(threads, nthreads, &first);
+    prev = first;
+    uint64_t next_report = first.time + sender_params.stats_interval * NSEC_PER_SEC;
+    while (1) {
+        int running = 0;
+
+        for (i = 0; i < nthreads; i++)
+            running += __atomic_load_n(&threads[i].running, __ATOMIC_ACQUIRE);
+        if (!running)
+            break;
+        sleep_ns(100 * NSEC_PER_MSEC);
+        if (sender_params.stats_interval > 0 && now_ns() >= next_report) {
+            sample_stats(threads, nthreads, &cur);
+            print_interval(&cur, &prev, &first);
+            prev = cur;
+            next_report += sender_params.stats_interval * NSEC_PER_SEC;
+        }
+    }
+
+    uint64_t start = UINT64_MAX, finish = 0;
+    uint64_t tx_unmatched = 0;
+    tx_latency_t tx_latency[TX_STAGES] = {};
+    for (i = 0; i < nthreads; i++) {
+        sender_thread_t *thread = &threads[i];
+
+        if (thread->count == 0)
+            continue;
+        pthread_join(thread->tid, NULL);
+        tx_unmatched += thread->tx_unmatched;
+        merge_tx_latency(tx_latency, thread->tx_latency);
+        if (thread->ret)
+            ret = thread->ret;
+        if (nthreads > 1)
+            printf("thread %d (cpu %d): sent %llu packets in %.3f s\n",
+                   thread->id, thread->cpu, (unsigned long long)thread->stats.sent,
+                   (double)(thread->end - thread->start) / NSEC_PER_SEC);
+        if (thread->start && thread->start < start)
+            start = thread->start;
+        if (thread->end > finish)
+            finish = thread->end;
+    }
+    sample_stats(threads, nthreads, &cur);
+
+    uint64_t sent = cur.stats.sent;
+    double elapsed = finish > start ? (double)(finish - start) / NSEC_PER_SEC : 0;
+    double pps = elapsed > 0 ? sent / elapsed : 0;
+    printf("sent %llu packets, %llu bytes in %.3f s\n", (unsigned long long)sent,
+           (unsigned long long)cur.stats.bytes, elapsed);
+    if (sender_params.pps > 0)
+        printf("rate achieved %.0f pps, %.3f Gbit/s; requested %.0f pps, %.3f Gbit/s\n",
+               pps, elapsed > 0 ? cur.stats.bytes * 8 / elapsed / 1e9 : 0,
+               sender_params.pps, sender_params.pps * avg_len * 8 / 1e9);
+    else
+        printf("rate achieved %.0f pps, %.3f Gbit/s\n",
+               pps, elapsed > 0 ? cur.stats.bytes * 8 / elapsed / 1e9 : 0);
+    printf("cpu %.3f s, idle %.3f s, blocked %.3f s\n",
+           (double)cur.cpu_ns / NSEC_PER_SEC, (double)cur.stats.idle_ns / NSEC_PER_SEC,
+           blocked_seconds(&cur, &first));
+    printf("send errors %llu\n", (unsigned long long)sum_errors(&cur.stats));
+    for (i = 0; i < MAX_ERRNO; i++)
+        if (cur.stats.errors[i])
+            printf("  errno %d (%s): %llu\n", i, strerror(i),
+                   (unsigned long long)cur.stats.errors[i]);
+    if (sender_params.tx_timestamp)
+        print_tx_latency(tx_latency, sent, tx_unmatched);
+    if (sender_params.json)
+        write_result(&sender_params, &cur, &first, elapsed, tx_len, tx_latency);
+
 end:
-    close(sockfd);
+    if (handlers) {
+        sigaction(SIGINT, &old_int, NULL);
+        sigaction(SIGTERM, &old_term, NULL);
+    }
+    if (sockfd >= 0)
+        close(sockfd);
+    free(threads);
+    pcap_unload(&pcap);
+    free(sizes);
     free(sendbuf);
     return ret;
 }
+
+#ifndef L2_SENDER_LIBRARY
+int main(int argc, char *argv[])
+{
+    return l2_sender_main(argc, argv);
+}
+#endif
@@ -2,12 +2,40 @@
 # -*- coding: utf-8 -*-
 import argparse
 import binascii
+import ctypes
 import fcntl
+import os
 import re
 import socket
 import struct
+import sys
 import time
 
+class NativeSender(object):
+    '''
+    ctypes binding of libl2sender.so, l2_packet_sender.c built as a library
+    (see the build line at the top of l2_packet_sender.c). Looked up in
+    $L2_SENDER_LIB, then next to this script.
+    '''
+    def __init__(self, path):
+        self.lib = ctypes.CDLL(path)
+        self.lib.l2_sender_main.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_char_p)]
+        self.lib.l2_sender_main.restype = ctypes.c_int
+
+    @staticmethod
+    def load():
+        default = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'libl2sender.so')
+        try:
+            return NativeSender(os.environ.get('L2_SENDER_LIB', default))
+        except OSError:
+            return None
+
+    def main(self, argv):
+        # The whole send loop runs in C, ctypes drops the GIL meanwhile
+        args = [bytes(a, encoding='ascii') for a in argv]
+        c_argv = (ctypes.c_char_p * (len(args) + 1))(*args, None)
+        return self.lib.l2_sender_main(len(args), c_argv)
+
 class EthFrame():
     ETH_HDR_FMT = '!6s6sH'
     ETH_HDR_LEN = 6 + 6 + 2
@@ -82,8 +110,27 @@ def main():
     parser.add_argument('-m', '--dst_mac', type=verify_mac, default='12:23:34:45:56:67')
     parser.add_argument('-p', '--ether_proto', type=verify_hex, default='0x8951')
     parser.add_argument('-d', '--data', default="hello")
+    parser.add_argument('-b', '--batch', type=int, default=1)
     args = parser.parse_args()
 
+    native = NativeSender.load()
+    if native is not None:
+        # Same options, handed over to the native sender
+        argv = ['l2_packet_sender',
+                '--interface', args.interface,
+                '--interval', str(args.interval),
+                '--packetsize', str(args.packetsize),
+                '--count', str(args.count),
+                '--dst_mac', ':'.join(re.findall('[0-9a-f]{2}', args.dst_mac.lower())),
+                '--ether_proto', args.ether_proto,
+                '--data', args.data,
+                '--batch', str(args.batch)]
+        sys.exit(1 if native.main(argv) else 0)
+
+    # One packet per send without the native sender
+    if args.batch != 1:
+        parser.error('--batch needs libl2sender.so, see $L2_SENDER_LIB')
+
     # Get info of interface
     iface = Interface(args.interface)
 
@@ -92,9 +139,7 @@ def main():
         args.packetsize = iface.get_mtu()
 
     # Packet data
-    payload = ''
-    for i in range(args.packetsize):
-        payload += args.data[i % len(args.data)]
+    payload = (args.data * (args.packetsize // len(args.data) + 1))[:args.packetsize]
 
     # Construct the Ethernet frame
     src_mac = iface.get_mac()
@@ -0,0 +1,1011 @@
+/*
+ * Native counterpart of dot_find_cycles.py for systems without Python and
+ * networkx, such as initramfs debug shells. DOT edge statements are
+ * streamed into a CSR adjacency with interned node names, strongly
+ * connected components come from Tarjan's algorithm and cycles from
+ * Johnson's algorithm, a depth limited DFS (--max-length) or one BFS per
+ * node (--only-shortest). Options and output match the script, only the
+ * order of a full enumeration may differ.
+ *
+ *   gcc -O2 -o dot_find_cycles dot_find_cycles.c
+ *   systemd-analyze dot | ./dot_find_cycles --only-shortest
+ *
+ * Edges to or from a subgraph ("a -> { b c }") are not expanded, the
+ * nodes of the subgraph are still added.
+ */
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef struct {
+    int only_shortest;
+    long max_cycles;
+    int max_length;
+} cycle_params_t;
+
+typedef struct {
+    /* interned names, name_off[i] is the offset of node i in pool */
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+    uint32_t *name_off;
+    uint32_t nodes;
+    uint32_t nodes_cap;
+    /* open addressing, node index + 1, 0 is empty */
+    uint32_t *hash;
+    uint32_t hash_cap;
+    /* edges in input order until the CSR is built */
+    uint32_t *edge_src;
+    uint32_t *edge_dst;
+    size_t edges;
+    size_t edges_cap;
+    /* CSR: successors of u are col[row[u]] .. col[row[u + 1] - 1] */
+    uint32_t *row;
+    uint32_t *col;
+} graph_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+    uint32_t *members; /* sorted by name */
+} component_t;
+
+enum { TOK_EOF, TOK_ID, TOK_EDGEOP, TOK_PUNCT };
+
+typedef struct {
+    FILE *fp;
+    int type;
+    int quoted;
+    int punct;
+    int pushed;
+    int bol;
+    char *text;
+    size_t len;
+    size_t cap;
+} lexer_t;
+
+static const graph_t *sort_graph;
+static long cycles_left;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size ? size : 1);
+    if (!ptr) {
+        perror("realloc");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void *xcalloc(size_t nmemb, size_t size)
+{
+    void *ptr = calloc(nmemb ? nmemb : 1, size);
+
+    if (!ptr) {
+        perror("calloc");
+        exit(1);
+    }
+    return ptr;
+}
+
+static const char *node_name(const graph_t *g, uint32_t node)
+{
+    return g->pool + g->name_off[node];
+}
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+static void rehash(graph_t *g)
+{
+    uint32_t i;
+
+    g->hash_cap = g->hash_cap ? g->hash_cap * 2 : 1024;
+    free(g->hash);
+    g->hash = xcalloc(g->hash_cap, sizeof(*g->hash));
+    for (i = 0; i < g->nodes; i++) {
+        uint32_t h = hash_name(node_name(g, i)) & (g->hash_cap - 1);
+
+        while (g->hash[h])
+            h = (h + 1) & (g->hash_cap - 1);
+        g->hash[h] = i + 1;
+    }
+}
+
+static uint32_t intern(graph_t *g, const char *name, size_t len)
+{
+    uint32_t h;
+
+    if (g->nodes * 2 >= g->hash_cap)
+        rehash(g);
+
+    h = hash_name(name) & (g->hash_cap - 1);
+    while (g->hash[h]) {
+        if (strcmp(node_name(g, g->hash[h] - 1), name) == 0)
+            return g->hash[h] - 1;
+        h = (h + 1) & (g->hash_cap - 1);
+    }
+
+    if (g->pool_len + len + 1 > g->pool_cap) {
+        while (g->pool_len + len + 1 > g->pool_cap)
+            g->pool_cap = g->pool_cap ? g->pool_cap * 2 : 65536;
+        g->pool = xrealloc(g->pool, g->pool_cap);
+    }
+    if (g->nodes == g->nodes_cap) {
+        g->nodes_cap = g->nodes_cap ? g->nodes_cap * 2 : 1024;
+        g->name_off = xrealloc(g->name_off, g->nodes_cap * sizeof(*g->name_off));
+    }
+    memcpy(g->pool + g->pool_len, name, len + 1);
+    g->name_off[g->nodes] = g->pool_len;
+    g->pool_len += len + 1;
+    g->hash[h] = g->nodes + 1;
+
+    return g->nodes++;
+}
+
+static void add_edge(graph_t *g, uint32_t src, uint32_t dst)
+{
+    if (g->edges == g->edges_cap) {
+        g->edges_cap = g->edges_cap ? g->edges_cap * 2 : 4096;
+        g->edge_src = xrealloc(g->edge_src, g->edges_cap * sizeof(*g->edge_src));
+        g->edge_dst = xrealloc(g->edge_dst, g->edges_cap * sizeof(*g->edge_dst));
+    }
+    g->edge_src[g->edges] = src;
+    g->edge_dst[g->edges] = dst;
+    g->edges++;
+}
+
+/* Parallel edges are merged like in a networkx DiGraph, input order is kept */
+static void build_csr(graph_t *g)
+{
+    uint32_t *mark = xcalloc(g->nodes, sizeof(*mark));
+    uint32_t *fill = xcalloc(g->nodes + 1, sizeof(*fill));
+    uint32_t u, pos = 0;
+    size_t i;
+
+    g->row = xcalloc(g->nodes + 1, sizeof(*g->row));
+    g->col = xrealloc(NULL, g->edges * sizeof(*g->col));
+
+    for (i = 0; i < g->edges; i++)
+        g->row[g->edge_src[i] + 1]++;
+    for (u = 0; u < g->nodes; u++)
+        g->row[u + 1] += g->row[u];
+    memcpy(fill, g->row, (g->nodes + 1) * sizeof(*fill));
+    for (i = 0; i < g->edges; i++)
+        g->col[fill[g->edge_src[i]]++] = g->edge_dst[i];
+
+    for (u = 0; u < g->nodes; u++) {
+        uint32_t start = g->row[u], end = g->row[u + 1], e;
+
+        g->row[u] = pos;
+        for (e = start; e < end; e++) {
+            if (mark[g->col[e]] == u + 1)
+                continue;
+            mark[g->col[e]] = u + 1;
+            g->col[pos++] = g->col[e];
+        }
+    }
+    g->row[g->nodes] = pos;
+
+    free(g->edge_src);
+    free(g->edge_dst);
+    g->edge_src = g->edge_dst = NULL;
+    g->edges = pos;
+    free(mark);
+    free(fill);
+}
+
+static void lex_putc(lexer_t *lx, int c)
+{
+    if (lx->len + 1 >= lx->cap) {
+        lx->cap = lx->cap ? lx->cap * 2 : 256;
+        lx->text = xrealloc(lx->text, lx->cap);
+    }
+    lx->text[lx->len++] = c;
+    lx->text[lx->len] = '\0';
+}
+
+static int lex_getc(lexer_t *lx)
+{
+    int c = getc_unlocked(lx->fp);
+
+    /* '#' lines are C preprocessor output and ignored */
+    while (c == '#' && lx->bol) {
+        while (c != '\n' && c != EOF)
+            c = getc_unlocked(lx->fp);
+        if (c == '\n')
+            c = getc_unlocked(lx->fp);
+    }
+    lx->bol = c == '\n';
+    return c;
+}
+
+static int is_id_char(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == '.' || c >= 0x80;
+}
+
+static int lex_next(lexer_t *lx)
+{
+    int c;
+
+    if (lx->pushed) {
+        lx->pushed = 0;
+        return lx->type;
+    }
+
+    lx->len = 0;
+    lx->quoted = 0;
+    if (lx->text)
+        lx->text[0] = '\0';
+
+again:
+    do
+        c = lex_getc(lx);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+
+    if (c == EOF)
+        return lx->type = TOK_EOF;
+
+    if (c == '/') {
+        int next = lex_getc(lx);
+
+        if (next == '/') {
+            while (c != '\n' && c != EOF)
+                c = lex_getc(lx);
+            goto again;
+        }
+        if (next == '*') {
+            int prev = 0;
+
+            while ((c = lex_getc(lx)) != EOF && !(prev == '*' && c == '/'))
+                prev = c;
+            goto again;
+        }
+        ungetc(next, lx->fp);
+        lx->punct = c;
+        return lx->type = TOK_PUNCT;
+    }
+
+    if (c == '"') {
+        /* kept verbatim like networkx, which only strips the quotes */
+        lx->quoted = 1;
+        lex_putc(lx, '\0');
+        lx->len = 0; /* text is "" for an empty string */
+        while ((c = lex_getc(lx)) != EOF && c != '"') {
+            if (c == '\\') {
+                int next = lex_getc(lx);
+
+                if (next == '\n')
+                    continue;
+                lex_putc(lx, c);
+                c = next;
+                if (c == EOF)
+                    break;
+            }
+            lex_putc(lx, c);
+        }
+        return lx->type = TOK_ID;
+    }
+
+    if (c == '<') {
+        int depth = 1;
+
+        lx->quoted = 1;
+        lex_putc(lx, c);
+        while (depth && (c = lex_getc(lx)) != EOF) {
+            depth += c == '<' ? 1 : c == '>' ? -1 : 0;
+            lex_putc(lx, c);
+        }
+        return lx->type = TOK_ID;
+    }
+
+    if (c == '-') {
+        int next = lex_getc(lx);
+
+        if (next == '>' || next == '-')
+            return lx->type = TOK_EDGEOP;
+        ungetc(next, lx->fp);
+        lex_putc(lx, c);
+        c = lex_getc(lx);
+    }
+
+    if (is_id_char(c)) {
+        while (is_id_char(c)) {
+            lex_putc(lx, c);
+            c = lex_getc(lx);
+        }
+        if (c != EOF)
+            ungetc(c, lx->fp);
+        return lx->type = TOK_ID;
+    }
+
+    if (lx->len)
+        return lx->type = TOK_ID;
+
+    lx->punct = c;
+    return lx->type = TOK_PUNCT;
+}
+
+static void lex_pushback(lexer_t *lx)
+{
+    lx->pushed = 1;
+}
+
+static int is_punct(const lexer_t *lx, int type, int punct)
+{
+    return type == TOK_PUNCT && lx->punct == punct;
+}
+
+/* Skips "[ ... ]", the '[' is already consumed */
+static void skip_attrs(lexer_t *lx)
+{
+    int type;
+
+    while ((type = lex_next(lx)) != TOK_EOF && !is_punct(lx, type, ']'))
+        ;
+}
+
+/* Skips ":port" and ":port:compass" after a node id, returns the next token */
+static int skip_port(lexer_t *lx)
+{
+    int type = lex_next(lx);
+
+    while (is_punct(lx, type, ':')) {
+        lex_next(lx);
+        type = lex_next(lx);
+    }
+    return type;
+}
+
+static void parse_dot(graph_t *g, lexer_t *lx)
+{
+    char *name = NULL;
+    size_t name_cap = 0;
+    int type;
+
+    while ((type = lex_next(lx)) != TOK_EOF) {
+        uint32_t src, dst;
+
+        if (type == TOK_PUNCT) {
+            if (lx->punct == '[')
+                skip_attrs(lx);
+            continue;
+        }
+        if (type == TOK_EDGEOP)
+            continue;
+
+        if (!lx->quoted) {
+            if (strcasecmp(lx->text, "strict") == 0 || strcasecmp(lx->text, "node") == 0 ||
+                strcasecmp(lx->text, "edge") == 0)
+                continue;
+            if (strcasecmp(lx->text, "digraph") == 0 || strcasecmp(lx->text, "graph") == 0 ||
+                strcasecmp(lx->text, "subgraph") == 0) {
+                /* optional graph name */
+                if (lex_next(lx) != TOK_ID)
+                    lex_pushback(lx);
+                continue;
+            }
+        }
+
+        if (lx->len + 1 > name_cap) {
+            name_cap = lx->len + 1;
+            name = xrealloc(name, name_cap);
+        }
+        memcpy(name, lx->text, lx->len + 1);
+
+        type = skip_port(lx);
+        if (is_punct(lx, type, '=')) {
+            /* graph attribute "id = value" */
+            lex_next(lx);
+            continue;
+        }
+
+        src = intern(g, name, strlen(name));
+        while (type == TOK_EDGEOP) {
+            type = lex_next(lx);
+            if (type != TOK_ID)
+                break;
+            dst = intern(g, lx->text, lx->len);
+            add_edge(g, src, dst);
+            src = dst;
+            type = skip_port(lx);
+        }
+        lex_pushback(lx);
+    }
+
+    free(name);
+}
+
+/* Iterative Tarjan, comp[v] is the component of v */
+static uint32_t tarjan(const graph_t *g, uint32_t *comp)
+{
+    uint32_t *index = xcalloc(g->nodes, sizeof(*index));
+    uint32_t *low = xcalloc(g->nodes, sizeof(*low));
+    uint32_t *pos = xcalloc(g->nodes, sizeof(*pos));
+    uint32_t *stack = xcalloc(g->nodes, sizeof(*stack));
+    uint32_t *calls = xcalloc(g->nodes, sizeof(*calls));
+    char *on_stack = xcalloc(g->nodes, 1);
+    uint32_t next_index = 1, ncomp = 0, sp = 0, cp, root;
+
+    for (root = 0; root < g->nodes; root++) {
+        if (index[root])
+            continue;
+
+        cp = 0;
+        calls[cp++] = root;
+        index[root] = low[root] = next_index++;
+        pos[root] = g->row[root];
+        stack[sp++] = root;
+        on_stack[root] = 1;
+
+        while (cp) {
+            uint32_t v = calls[cp - 1];
+
+            if (pos[v] < g->row[v + 1]) {
+                uint32_t w = g->col[pos[v]++];
+
+                if (!index[w]) {
+                    index[w] = low[w] = next_index++;
+                    pos[w] = g->row[w];
+                    stack[sp++] = w;
+                    on_stack[w] = 1;
+                    calls[cp++] = w;
+                } else if (on_stack[w] && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            if (low[v] == index[v]) {
+                uint32_t w;
+
+                do {
+                    w = stack[--sp];
+                    on_stack[w] = 0;
+                    comp[w] = ncomp;
+                } while (w != v);
+                ncomp++;
+            }
+            cp--;
+            if (cp && low[v] < low[calls[cp - 1]])
+                low[calls[cp - 1]] = low[v];
+        }
+    }
+
+    free(index);
+    free(low);
+    free(pos);
+    free(stack);
+    free(calls);
+    free(on_stack);
+
+    return ncomp;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp(node_name(sort_graph, *(const uint32_t *)a),
+                  node_name(sort_graph, *(const uint32_t *)b));
+}
+
+static int cmp_component(const void *a, const void *b)
+{
+    const component_t *ca = a, *cb = b;
+
+    if (ca->size != cb->size)
+        return ca->size > cb->size ? -1 : 1;
+    return ca->id < cb->id ? -1 : ca->id > cb->id;
+}
+
+/* Components with a cycle, largest first, members sorted by name */
+static uint32_t nontrivial_components(const graph_t *g, const uint32_t *comp, uint32_t ncomp,
+                                      component_t **out, uint32_t *order)
+{
+    uint32_t *size = xcalloc(ncomp, sizeof(*size));
+    uint32_t *slot = xrealloc(NULL, ncomp * sizeof(*slot));
+    char *self_loop = xcalloc(ncomp, 1);
+    component_t *comps;
+    uint32_t v, c, n = 0;
+
+    for (v = 0; v < g->nodes; v++) {
+        uint32_t e;
+
+        size[comp[v]]++;
+        for (e = g->row[v]; e < g->row[v + 1]; e++)
+            if (g->col[e] == v)
+                self_loop[comp[v]] = 1;
+    }
+
+    comps = xcalloc(ncomp, sizeof(*comps));
+    for (c = 0; c < ncomp; c++) {
+        slot[c] = UINT32_MAX;
+        if (size[c] < 2 && !self_loop[c])
+            continue;
+        comps[n].id = c;
+        comps[n].members = xrealloc(NULL, size[c] * sizeof(uint32_t));
+        slot[c] = n++;
+    }
+    for (v = 0; v < g->nodes; v++) {
+        component_t *cv = slot[comp[v]] == UINT32_MAX ? NULL : &comps[slot[comp[v]]];
+
+        if (cv)
+            cv->members[cv->size++] = v;
+    }
+
+    sort_graph = g;
+    for (c = 0; c < n; c++) {
+        qsort(comps[c].members, comps[c].size, sizeof(uint32_t), cmp_name);
+        for (v = 0; v < comps[c].size; v++)
+            order[comps[c].members[v]] = v;
+    }
+    qsort(comps, n, sizeof(*comps), cmp_component);
+
+    free(size);
+    free(slot);
+    free(self_loop);
+    *out = comps;
+
+    return n;
+}
+
+static void print_repr(const char *s)
+{
+    int quote = strchr(s, '\'') && !strchr(s, '"') ? '"' : '\'';
+
+    putchar(quote);
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == quote || c == '\\') {
+            putchar('\\');
+            putchar(c);
+        } else if (c == '\n') {
+            fputs("\\n", stdout);
+        } else if (c == '\r') {
+            fputs("\\r", stdout);
+        } else if (c == '\t') {
+            fputs("\\t", stdout);
+        } else if (c < 0x20 || c == 0x7f) {
+            printf("\\x%02x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar(quote);
+}
+
+/* Prints a cycle as a Python list like the script, returns 1 once the cap is hit */
+static int emit_cycle(const graph_t *g, const uint32_t *cycle, uint32_t len)
+{
+    uint32_t i;
+
+    putchar('[');
+    for (i = 0; i < len; i++) {
+        if (i)
+            fputs(", ", stdout);
+        print_repr(node_name(g, cycle[i]));
+    }
+    fputs("]\n", stdout);
+
+    return cycles_left > 0 && --cycles_left == 0;
+}
+
+typedef struct {
+    uint32_t *pool;
+    size_t pool_len;
+    size_t pool_cap;
+    /* offset + 1 into pool, 0 is empty; pool[offset] is the length */
+    size_t *slots;
+    size_t cap;
+    size_t used;
+} cycle_set_t;
+
+static uint32_t cycle_hash(const uint32_t *cycle, uint32_t len)
+{
+    uint32_t h = 2166136261u, i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ cycle[i]) * 16777619u;
+    return h;
+}
+
+/* Returns 1 if the (rotated) cycle was not in the set yet */
+static int cycle_set_add(cycle_set_t *set, const uint32_t *cycle, uint32_t len)
+{
+    size_t h, i;
+
+    if (set->used * 2 >= set->cap) {
+        size_t *old = set->slots, old_cap = set->cap;
+
+        set->cap = set->cap ? set->cap * 2 : 1024;
+        set->slots = xcalloc(set->cap, sizeof(*set->slots));
+        for (i = 0; i < old_cap; i++) {
+            if (!old[i])
+                continue;
+            h = cycle_hash(set->pool + old[i], set->pool[old[i] - 1]) & (set->cap - 1);
+            while (set->slots[h])
+                h = (h + 1) & (set->cap - 1);
+            set->slots[h] = old[i];
+        }
+        free(old);
+    }
+
+    h = cycle_hash(cycle, len) & (set->cap - 1);
+    while (set->slots[h]) {
+        size_t off = set->slots[h];
+
+        if (set->pool[off - 1] == len && memcmp(set->pool + off, cycle, len * sizeof(*cycle)) == 0)
+            return 0;
+        h = (h + 1) & (set->cap - 1);
+    }
+
+    if (set->pool_len + len + 1 > set->pool_cap) {
+        while (set->pool_len + len + 1 > set->pool_cap)
+            set->pool_cap = set->pool_cap ? set->pool_cap * 2 : 4096;
+        set->pool = xrealloc(set->pool, set->pool_cap * sizeof(*set->pool));
+    }
+    set->pool[set->pool_len++] = len;
+    memcpy(set->pool + set->pool_len, cycle, len * sizeof(*cycle));
+    set->slots[h] = set->pool_len;
+    set->pool_len += len;
+    set->used++;
+
+    return 1;
+}
+
+/* Shortest cycle through each node by BFS back to it, O(V * E) per component */
+static int shortest_cycles(const graph_t *g, const uint32_t *comp, const uint32_t *order,
+                           const component_t *c, int max_length)
+{
+    uint32_t *parent = xcalloc(g->nodes, sizeof(*parent));
+    uint32_t *depth = xcalloc(g->nodes, sizeof(*depth));
+    uint32_t *visit = xcalloc(g->nodes, sizeof(*visit));
+    uint32_t *queue = xcalloc(c->size, sizeof(*queue));
+    uint32_t *cycle = xcalloc(c->size, sizeof(*cycle));
+    uint32_t *key = xcalloc(c->size, sizeof(*key));
+    cycle_set_t seen = {};
+    uint32_t i;
+    int stop = 0;
+
+    for (i = 0; i < c->size && !stop; i++) {
+        uint32_t start = c->members[i], head = 0, tail = 0, len = 0, min = 0, j;
+
+        visit[start] = i + 1;
+        depth[start] = 0;
+        queue[tail++] = start;
+        while (head < tail && !len) {
+            uint32_t node = queue[head++], e;
+
+            if (max_length > 0 && depth[node] >= (uint32_t)max_length)
+                break;
+            for (e = g->row[node]; e < g->row[node + 1]; e++) {
+                uint32_t succ = g->col[e];
+
+                if (comp[succ] != c->id)
+                    continue;
+                if (succ == start) {
+                    for (len = 0; node != start; node = parent[node])
+                        cycle[len++] = node;
+                    cycle[len++] = start;
+                    break;
+                }
+                if (visit[succ] != i + 1) {
+                    visit[succ] = i + 1;
+                    parent[succ] = node;
+                    depth[succ] = depth[node] + 1;
+                    queue[tail++] = succ;
+                }
+            }
+        }
+        if (!len)
+            continue;
+
+        /* built backwards from the last node, reverse into path order */
+        for (j = 0; j < len / 2; j++) {
+            uint32_t tmp = cycle[j];
+
+            cycle[j] = cycle[len - 1 - j];
+            cycle[len - 1 - j] = tmp;
+        }
+
+        /* the same cycle is found from each of its nodes, print it once */
+        for (j = 1; j < len; j++)
+            if (order[cycle[j]] < order[cycle[min]])
+                min = j;
+        for (j = 0; j < len; j++)
+            key[j] = cycle[(min + j) % len];
+        if (!cycle_set_add(&seen, key, len))
+            continue;
+
+        stop = emit_cycle(g, cycle, len);
+    }
+
+    free(parent);
+    free(depth);
+    free(visit);
+    free(queue);
+    free(cycle);
+    free(key);
+    free(seen.pool);
+    free(seen.slots);
+
+    return stop;
+}
+
+/*
+ * Each cycle is reported once, from its lowest ranked node, by a depth
+ * limited DFS that only visits nodes ranked above the start node.
+ */
+static int bounded_cycles(const graph_t *g, const uint32_t *comp, const uint32_t *order,
+                          const component_t *c, int max_length)
+{
+    uint32_t *path = xcalloc(c->size, sizeof(*path));
+    uint32_t *pos = xcalloc(c->size, sizeof(*pos));
+    char *on_path = xcalloc(g->nodes, 1);
+    uint32_t i;
+    int stop = 0;
+
+    for (i = 0; i < c->size && !stop; i++) {
+        uint32_t start = c->members[i], depth = 0;
+
+        path[depth] = start;
+        pos[depth++] = g->row[start];
+        on_path[start] = 1;
+        while (depth && !stop) {
+            uint32_t node = path[depth - 1], succ;
+
+            if (pos[depth - 1] == g->row[node + 1]) {
+                on_path[node] = 0;
+                depth--;
+                continue;
+            }
+            succ = g->col[pos[depth - 1]++];
+            if (comp[succ] != c->id || order[succ] < order[start])
+                continue;
+            if (succ == start) {
+                stop = emit_cycle(g, path, depth);
+            } else if (!on_path[succ] && depth < (uint32_t)max_length) {
+                path[depth] = succ;
+                pos[depth++] = g->row[succ];
+                on_path[succ] = 1;
+            }
+        }
+        while (depth)
+            on_path[path[--depth]] = 0;
+    }
+
+    free(path);
+    free(pos);
+    free(on_path);
+
+    return stop;
+}
+
+typedef struct {
+    uint32_t *items;
+    uint32_t len;
+    uint32_t cap;
+} node_list_t;
+
+/* Johnson's algorithm, the start node walks the component in name order */
+static int all_cycles(const graph_t *g, const uint32_t *comp, const uint32_t *order,
+                      const component_t *c)
+{
+    uint32_t *path = xcalloc(c->size, sizeof(*path));
+    uint32_t *pos = xcalloc(c->size, sizeof(*pos));
+    char *found = xcalloc(c->size, 1);
+    uint32_t *unblock = xcalloc(c->size, sizeof(*unblock));
+    char *blocked = xcalloc(g->nodes, 1);
+    node_list_t *b = xcalloc(g->nodes, sizeof(*b));
+    uint32_t i, j;
+    int stop = 0;
+
+#define IN_SUBGRAPH(w) (comp[w] == c->id && order[w] >= order[start])
+
+    for (i = 0; i < c->size && !stop; i++) {
+        uint32_t start = c->members[i], depth = 0;
+
+        for (j = i; j < c->size; j++) {
+            blocked[c->members[j]] = 0;
+            b[c->members[j]].len = 0;
+        }
+
+        path[depth] = start;
+        pos[depth] = g->row[start];
+        found[depth++] = 0;
+        blocked[start] = 1;
+        while (depth && !stop) {
+            uint32_t v = path[depth - 1], w, e;
+
+            if (pos[depth - 1] < g->row[v + 1]) {
+                w = g->col[pos[depth - 1]++];
+                if (!IN_SUBGRAPH(w))
+                    continue;
+                if (w == start) {
+                    found[depth - 1] = 1;
+                    stop = emit_cycle(g, path, depth);
+                } else if (!blocked[w]) {
+                    path[depth] = w;
+                    pos[depth] = g->row[w];
+                    found[depth++] = 0;
+                    blocked[w] = 1;
+                }
+                continue;
+            }
+
+            if (found[depth - 1]) {
+                uint32_t top = 0;
+
+                /* Nodes are unblocked as they are pushed, so each is pushed once */
+                blocked[v] = 0;
+                unblock[top++] = v;
+                while (top) {
+                    uint32_t u = unblock[--top];
+
+                    for (j = 0; j < b[u].len; j++) {
+                        w = b[u].items[j];
+                        if (blocked[w]) {
+                            blocked[w] = 0;
+                            unblock[top++] = w;
+                        }
+                    }
+                    b[u].len = 0;
+                }
+            } else {
+                for (e = g->row[v]; e < g->row[v + 1]; e++) {
+                    node_list_t *list;
+
+                    w = g->col[e];
+                    if (!IN_SUBGRAPH(w))
+                        continue;
+                    list = &b[w];
+                    for (j = 0; j < list->len && list->items[j] != v; j++)
+                        ;
+                    if (j < list->len)
+                        continue;
+                    if (list->len == list->cap) {
+                        list->cap = list->cap ? list->cap * 2 : 4;
+                        list->items = xrealloc(list->items, list->cap * sizeof(*list->items));
+                    }
+                    list->items[list->len++] = v;
+                }
+            }
+            depth--;
+            if (depth && found[depth])
+                found[depth - 1] = 1;
+        }
+    }
+
+#undef IN_SUBGRAPH
+
+    for (i = 0; i < c->size; i++)
+        free(b[c->members[i]].items);
+    free(b);
+    free(path);
+    free(pos);
+    free(found);
+    free(unblock);
+    free(blocked);
+
+    return stop;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--only-shortest] [--max-cycles N] [--max-length L] [DOTFILE]\n"
+            "Finds cycles in dot file graphs, such as those from systemd-analyze dot.\n"
+            "Uses standard input if DOTFILE is '-' or not present.\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    cycle_params_t cycle_params = {};
+    graph_t graph = {};
+    lexer_t lexer = {.bol = 1};
+    component_t *comps = NULL;
+    uint32_t *comp = NULL, *order = NULL;
+    uint32_t ncomp, nontrivial = 0, i, j;
+
+    static struct option long_options[] = {
+        {"only-shortest", no_argument, NULL, 's'},
+        {"max-cycles", required_argument, NULL, 'n'},
+        {"max-length", required_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    for (;;) {
+        int c = getopt_long(argc, argv, "h", long_options, NULL);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 's':
+            cycle_params.only_shortest = 1;
+            break;
+        case 'n':
+            cycle_params.max_cycles = strtol(optarg, NULL, 0);
+            break;
+        case 'l':
+            cycle_params.max_length = strtol(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind < argc && strcmp(argv[optind], "-") != 0) {
+        lexer.fp = fopen(argv[optind], "r");
+        if (!lexer.fp) {
+            perror(argv[optind]);
+            return 1;
+        }
+    } else {
+        lexer.fp = stdin;
+    }
+
+    parse_dot(&graph, &lexer);
+    build_csr(&graph);
+
+    comp = xcalloc(graph.nodes, sizeof(*comp));
+    order = xcalloc(graph.nodes, sizeof(*order));
+    ncomp = tarjan(&graph, comp);
+    nontrivial = nontrivial_components(&graph, comp, ncomp, &comps, order);
+
+    fprintf(stderr, "%u nodes, %zu edges, %u strongly connected components with cycles\n",
+            graph.nodes, graph.edges, nontrivial);
+    for (i = 0; i < nontrivial; i++) {
+        fprintf(stderr, "component %u: %u nodes:", i, comps[i].size);
+        for (j = 0; j < comps[i].size; j++)
+            fprintf(stderr, " %s", node_name(&graph, comps[i].members[j]));
+        fputc('\n', stderr);
+    }
+
+    cycles_left = cycle_params.max_cycles;
+    for (i = 0; i < nontrivial; i++) {
+        int stop;
+
+        if (cycle_params.only_shortest)
+            stop = shortest_cycles(&graph, comp, order, &comps[i], cycle_params.max_length);
+        else if (cycle_params.max_length > 0)
+            stop = bounded_cycles(&graph, comp, order, &comps[i], cycle_params.max_length);
+        else
+            stop = all_cycles(&graph, comp, order, &comps[i]);
+        if (stop)
+            break;
+    }
+
+    if (lexer.fp != stdin)
+        fclose(lexer.fp);
+    for (i = 0; i < nontrivial; i++)
+        free(comps[i].members);
+    free(comps);
+    free(comp);
+    free(order);
+    free(lexer.text);
+    free(graph.pool);
+    free(graph.name_off);
+    free(graph.hash);
+    free(graph.row);
+    free(graph.col);
+
+    return 0;
+}
@@ -31,11 +31,25 @@ pyparsing==2.1.9
 
 USAGE:
 dot_find_cycles.py /path/to/file.dot
+systemd-analyze dot | dot_find_cycles.py --only-shortest
+
+Cycles are only searched for inside the strongly connected components of the
+graph, which are listed on stderr first. On large graphs (a full
+systemd-analyze dot has thousands of units) use --only-shortest, or bound the
+enumeration with --max-cycles and --max-length.
+
+dot_find_cycles.c is a native build of the same tool, with the same options and
+output, for systems without Python and networkx.
 
 The canonical source of this script can always be found from:
 <http://blog.jasonantman.com/2012/03/python-script-to-find-dependency-cycles-in-graphviz-dot-files/>
 
 CHANGELOG:
+2026-10-19 util-tools:
+  - enumerate cycles per strongly connected component and report the components
+  - add --max-cycles and --max-length to bound the enumeration
+  - --only-shortest now runs one BFS per node instead of filtering all cycles
+
 2018-05-23 Nikolaus Wittenstein <nikolaus.wittenstein@gmail.com>:
   - add Python 3 support
 
@@ -56,6 +70,8 @@ CHANGELOG:
 import sys
 from os import path, access, R_OK
 import argparse
+import itertools
+from collections import deque
 import networkx as nx
 from networkx.drawing.nx_pydot import read_dot
 
@@ -67,40 +83,108 @@ def main():
             help="the dotfile to process. Uses standard input if argument is '-' or not present")
     parser.add_argument("--only-shortest", action='store_true',
             help="only show the shortest cycles. Example: if both A->C and A->B->C exist, only show the former. "
-            "This vastly reduces the amount of output when analysing dependency issues.")
+            "This vastly reduces the amount of output when analysing dependency issues. "
+            "Finds the shortest cycle through every node, so it stays fast on large graphs.")
+    parser.add_argument("--max-cycles", type=int, default=0, metavar='N',
+            help="stop after printing N cycles (default: no limit)")
+    parser.add_argument("--max-length", type=int, default=0, metavar='L',
+            help="only enumerate cycles of at most L nodes (default: no limit)")
     args = parser.parse_args()
 
     # read in the specified file, create a networkx DiGraph
     G = nx.DiGraph(read_dot(args.dotfile))
 
-    C = nx.simple_cycles(G)
-    if args.only_shortest:
-        C = remove_super_cycles(C)
+    # every cycle lies inside one strongly connected component
+    components = nontrivial_components(G)
+    sys.stderr.write("%d nodes, %d edges, %d strongly connected components with cycles\n"
+                     % (G.number_of_nodes(), G.number_of_edges(), len(components)))
+    for i, scc in enumerate(components):
+        sys.stderr.write("component %d: %d nodes: %s\n" % (i, len(scc), " ".join(sorted(scc))))
+
+    C = itertools.chain.from_iterable(component_cycles(G, scc, args) for scc in components)
+    if args.max_cycles > 0:
+        C = itertools.islice(C, args.max_cycles)
     for i in C:
         print(i)
 
 
-def remove_super_cycles(cycle_list):
-    # sorting by length makes the search easier, because shorter cycles cannot be supercycles of longer ones
-    cycle_list = sorted(cycle_list, key=len)
-    forward_index = 0
-    while forward_index < len(cycle_list):
-        backward_index = len(cycle_list) - 1
-        while backward_index > forward_index:
-            # when comparing two cycles, remove all elements that are not in the shortest one
-            filtered_list = [x for x in cycle_list[backward_index] if x in cycle_list[forward_index]]
-            # double the cycle length, to account for cycles shifted over the end of the list
-            full_cycle = filtered_list + filtered_list
-            # find the matching start position
-            while full_cycle and full_cycle[0] != cycle_list[forward_index][0]:
-                del full_cycle[0]
-            # matching start position found, now compare the rest
-            if cycle_list[forward_index] == full_cycle[:len(cycle_list[forward_index])]:
-                # cycle matches, remove supercycle from end result
-                del cycle_list[backward_index]
-            backward_index = backward_index - 1
-        forward_index = forward_index + 1
-    return cycle_list
+def nontrivial_components(G):
+    # components of one node only contain a cycle if the node has a self loop
+    components = [set(scc) for scc in nx.strongly_connected_components(G)]
+    components = [scc for scc in components
+                  if len(scc) > 1 or G.has_edge(next(iter(scc)), next(iter(scc)))]
+    return sorted(components, key=len, reverse=True)
+
+
+def component_cycles(G, scc, args):
+    if args.only_shortest:
+        return shortest_cycles(G, scc, args.max_length)
+    if args.max_length > 0:
+        return bounded_cycles(G, scc, args.max_length)
+    return nx.simple_cycles(G.subgraph(scc))
+
+
+def shortest_cycles(G, scc, max_length=0):
+    # shortest cycle through each node by BFS back to it, O(V * E) per component
+    adj = dict((node, [succ for succ in G.successors(node) if succ in scc]) for node in scc)
+    seen = set()
+    for start in sorted(scc):
+        parent = {start: None}
+        depth = {start: 0}
+        queue = deque([start])
+        cycle = None
+        while queue and cycle is None:
+            node = queue.popleft()
+            if max_length > 0 and depth[node] >= max_length:
+                break
+            for succ in adj[node]:
+                if succ == start:
+                    cycle = [node]
+                    while parent[cycle[-1]] is not None:
+                        cycle.append(parent[cycle[-1]])
+                    cycle.reverse()
+                    break
+                if succ not in parent:
+                    parent[succ] = node
+                    depth[succ] = depth[node] + 1
+                    queue.append(succ)
+        if cycle is None:
+            continue
+        # the same cycle is found from each of its nodes, print it once
+        key = rotate_to_min(cycle)
+        if key in seen:
+            continue
+        seen.add(key)
+        yield cycle
+
+
+def bounded_cycles(G, scc, max_length):
+    # each cycle is reported once, from its lowest ranked node, by a depth
+    # limited DFS that only visits nodes ranked above the start node
+    rank = dict((node, i) for i, node in enumerate(sorted(scc)))
+    for start in sorted(scc):
+        path = [start]
+        on_path = set(path)
+        stack = [iter(G.successors(start))]
+        while stack:
+            succ = next(stack[-1], None)
+            if succ is None:
+                stack.pop()
+                on_path.discard(path.pop())
+                continue
+            if succ not in rank or rank[succ] < rank[start]:
+                continue
+            if succ == start:
+                yield list(path)
+            elif succ not in on_path and len(path) < max_length:
+                path.append(succ)
+                on_path.add(succ)
+                stack.append(iter(G.successors(succ)))
+
+
+def rotate_to_min(cycle):
+    i = cycle.index(min(cycle))
+    return tuple(cycle[i:] + cycle[:i])
 
 
 if __name__ == "__main__":